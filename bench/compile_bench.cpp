@@ -0,0 +1,255 @@
+/*
+ * Compile-throughput benchmark: generates programs with vgen.hpp at growing
+ * function counts, nesting depths, expression sizes and global counts, and
+ * reports lines per second for lexing, parsing, code generation and object
+ * emission, then the peak RSS within each phase: the phase where it jumps is
+ * the one that needed the memory. Scanning and parsing interleave, so both
+ * come from one parse with tracing on, which sums up the scanner's time
+ * token by token; they share a peak. Every program is compiled in a child
+ * process, and each phase resets the high-water mark. A phase whose time per
+ * source byte grows more than SUPERLINEAR_RATIO times across a series is
+ * flagged; bytes, since longer expressions and global lists do not add lines.
+ *
+ *   make bench-compile && ./compile_bench [seed] [opt-level]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+#include "codegen.hpp"
+#include "node.hpp"
+#include "parse.hpp"
+#include "parser.hpp"
+#include "trace.hpp"
+#include "vgen.hpp"
+
+#define SUPERLINEAR_RATIO   2.0
+#define NUM_PHASES          5
+
+/* Generated by flex in tokens.cpp */
+int yylex_init_extra(ParseState *extra, yyscan_t *scanner);
+void yyset_in(FILE *in, yyscan_t scanner);
+int yylex_destroy(yyscan_t scanner);
+
+static const char *phase_names[NUM_PHASES] = { "lex", "parse", "codegen", "optimize", "emit" };
+
+struct Scale {
+    const char *series;
+    int functions;
+    int depth;
+    int expr_size;
+    int globals;
+};
+
+static const Scale scales[] = {
+    { "functions", 10, 2, 4, 8 },
+    { "functions", 100, 2, 4, 8 },
+    { "functions", 1000, 2, 4, 8 },
+    { "functions", 5000, 2, 4, 8 },
+    { "depth", 100, 1, 4, 8 },
+    { "depth", 100, 2, 4, 8 },
+    { "depth", 100, 3, 4, 8 },
+    { "depth", 100, 4, 4, 8 },
+    { "expr", 100, 2, 2, 8 },
+    { "expr", 100, 2, 8, 8 },
+    { "expr", 100, 2, 32, 8 },
+    { "expr", 100, 2, 128, 8 },
+    { "globals", 100, 2, 4, 10 },
+    { "globals", 100, 2, 4, 1000 },
+    { "globals", 100, 2, 4, 10000 },
+    { "globals", 100, 2, 4, 50000 },
+};
+
+/* What a child sends back through its pipe */
+struct Result {
+    long long lines;
+    long long bytes;
+    double seconds[NUM_PHASES];
+    long peak_kb[NUM_PHASES];   /* high-water mark of the RSS during each phase, -1 when shared with the next */
+};
+
+static double since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static FILE *open_text(std::string& text)
+{
+    return fmemopen(&text[0], text.size(), "r");
+}
+
+/* Runs the parser the way ParseProgram does, keeping the scanner's share of its time */
+static NProgram *parse_timed(std::string& text, Result *result)
+{
+    ParseState state = { NULL, NULL, "<bench>", 1, 1, 0 };
+    yyscan_t scanner;
+    FILE *in = open_text(text);
+
+    if (yylex_init_extra(&state, &scanner) != 0)
+        exit(1);
+    yyset_in(in, scanner);
+
+    Trace::ResetPeakResident();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int status = yyparse(scanner, &state);
+    double seconds = since(start);
+    result->peak_kb[1] = Trace::PeakResidentKB();
+
+    yylex_destroy(scanner);
+    fclose(in);
+    delete state.arena;
+
+    result->seconds[0] = state.lex_time / 1e9;
+    result->seconds[1] = seconds - result->seconds[0];
+    result->peak_kb[0] = -1;
+    return status == 0 ? state.program : NULL;
+}
+
+static Result compile_scale(const Scale& scale, uint64_t seed, int opt_level)
+{
+    GeneratorOptions options;
+    options.seed = seed;
+    options.functions = scale.functions;
+    options.depth = scale.depth;
+    options.expr_size = scale.expr_size;
+    options.globals = scale.globals;
+
+    std::string text = ProgramGenerator(options).Generate();
+    Result result = { 0, (long long)text.size(), { 0 }, { 0 } };
+
+    for (char c : text)
+        result.lines += (c == '\n');
+
+    /* Only this child records events, and never writes them out */
+    Trace::Enable();
+    NProgram *program = parse_timed(text, &result);
+
+    if (program == NULL)
+        exit(1);
+
+    CodeGenContext *context = new CodeGenContext();
+    context->SetupTargetMachine(opt_level, false);
+
+    Trace::ResetPeakResident();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    context->generateCode(*program);
+    result.seconds[2] = since(start);
+    result.peak_kb[2] = Trace::PeakResidentKB();
+
+    Trace::ResetPeakResident();
+    start = std::chrono::steady_clock::now();
+    context->OptimizeModule(opt_level, false);
+    result.seconds[3] = since(start);
+    result.peak_kb[3] = Trace::PeakResidentKB();
+
+    Trace::ResetPeakResident();
+    start = std::chrono::steady_clock::now();
+    context->EmitObjectFile("/dev/null");
+    result.seconds[4] = since(start);
+    result.peak_kb[4] = Trace::PeakResidentKB();
+
+    delete context;
+    delete program;
+    return result;
+}
+
+static bool run_child(const Scale& scale, uint64_t seed, int opt_level, Result *result)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return false;
+
+    fflush(stdout);
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        close(fds[0]);
+        Result r = compile_scale(scale, seed, opt_level);
+        _exit(write(fds[1], &r, sizeof(r)) == sizeof(r) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    bool ok = pid > 0 && read(fds[0], result, sizeof(*result)) == sizeof(*result);
+    close(fds[0]);
+
+    int status;
+    if (pid > 0)
+        waitpid(pid, &status, 0);
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 10) : 1;
+    int opt_level = argc > 2 ? atoi(argv[2]) : 0;
+    size_t num_scales = sizeof(scales) / sizeof(scales[0]);
+    std::vector<Result> results(num_scales);
+
+    printf("seed %llu, -O%d, thousands of lines per second\n", (unsigned long long)seed, opt_level);
+    printf("%-10s %6s %5s %5s %7s %9s", "series", "funcs", "depth", "expr", "globals", "lines");
+    for (int p = 0; p < NUM_PHASES; p++)
+        printf(" %9s", phase_names[p]);
+    printf("\n");
+
+    for (size_t s = 0; s < num_scales; s++) {
+        const Scale& scale = scales[s];
+
+        if (!run_child(scale, seed, opt_level, &results[s])) {
+            printf("[ERROR] %s %d/%d/%d/%d failed to compile\n", scale.series, scale.functions, scale.depth, scale.expr_size, scale.globals);
+            return 1;
+        }
+
+        const Result& r = results[s];
+        printf("%-10s %6d %5d %5d %7d %9lld", scale.series, scale.functions, scale.depth, scale.expr_size, scale.globals, r.lines);
+        for (int p = 0; p < NUM_PHASES; p++)
+            printf(" %9.1f", r.seconds[p] > 0 ? r.lines / r.seconds[p] / 1e3 : 0.0);
+        printf("\n");
+    }
+
+    printf("\npeak MB during each phase, lex and parse together\n");
+    printf("%-10s %6s %5s %5s %7s %9s", "series", "funcs", "depth", "expr", "globals", "lines");
+    for (int p = 0; p < NUM_PHASES; p++)
+        printf(" %9s", phase_names[p]);
+    printf("\n");
+
+    for (size_t s = 0; s < num_scales; s++) {
+        const Scale& scale = scales[s];
+        const Result& r = results[s];
+
+        printf("%-10s %6d %5d %5d %7d %9lld", scale.series, scale.functions, scale.depth, scale.expr_size, scale.globals, r.lines);
+        for (int p = 0; p < NUM_PHASES; p++) {
+            if (r.peak_kb[p] < 0)
+                printf(" %9s", "-");
+            else
+                printf(" %9.1f", r.peak_kb[p] / 1024.0);
+        }
+        printf("\n");
+    }
+
+    /* Time per byte should stay flat within a series; compare its first and last program */
+    int flagged = 0;
+    for (size_t first = 0; first < num_scales; ) {
+        size_t last = first;
+        while (last + 1 < num_scales && std::string(scales[last + 1].series) == scales[first].series)
+            last++;
+
+        for (int p = 0; p < NUM_PHASES; p++) {
+            double before = results[first].seconds[p] / results[first].bytes;
+            double after = results[last].seconds[p] / results[last].bytes;
+
+            if (before > 0 && after / before > SUPERLINEAR_RATIO) {
+                printf("[WARN] %s: %s takes %.1fx longer per byte on the largest program\n",
+                    scales[first].series, phase_names[p], after / before);
+                flagged++;
+            }
+        }
+        first = last + 1;
+    }
+
+    return flagged == 0 ? 0 : 2;
+}
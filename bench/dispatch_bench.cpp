@@ -0,0 +1,217 @@
+/*
+ * Node dispatch micro-benchmark: builds a synthetic AST of about a million
+ * nodes and walks it with the old dynamic_cast chains and with the kind-tag
+ * dispatch of VisitNode.
+ *
+ *   make bench-dispatch && ./dispatch_bench [statements] [rounds]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <chrono>
+#include <iostream>
+
+#include "node.hpp"
+#include "arena.hpp"
+#include "parser.hpp"
+
+static Arena arena;
+static const char *var_names[] = { "a", "b", "c", "d" };
+
+/* (v + k) * (v - k) over a rotating set of variables: 9 nodes */
+static NExpression *make_expr(int i)
+{
+    NIdentifier *id1 = arena.make<NIdentifier>(Symbol::Intern(var_names[i % 4]));
+    NIdentifier *id2 = arena.make<NIdentifier>(Symbol::Intern(var_names[(i + 1) % 4]));
+    NVariable *v1 = arena.make<NVariable>(*id1, VARIABLE_BASIC, *arena.make<NExpression>());
+    NVariable *v2 = arena.make<NVariable>(*id2, VARIABLE_BASIC, *arena.make<NExpression>());
+    NBinaryOp *add = arena.make<NBinaryOp>(*v1, TPLUS, *arena.make<NInteger>(i));
+    NBinaryOp *sub = arena.make<NBinaryOp>(*v2, TMINUS, *arena.make<NInteger>(i + 1));
+    return arena.make<NBinaryOp>(*add, TMUL, *sub);
+}
+
+/* An assignment or a print per statement: about 14 nodes each */
+static NProgram *make_program(int statements)
+{
+    StatementList *body = arena.make<StatementList>();
+
+    for (int i = 0; i < statements; i++) {
+        if (i % 2 == 0) {
+            NIdentifier *id = arena.make<NIdentifier>(Symbol::Intern(var_names[i % 4]));
+            NVariable *lhs = arena.make<NVariable>(*id, VARIABLE_BASIC, *arena.make<NExpression>());
+            body->push_back(arena.make<NAssignment>(*lhs, *make_expr(i)));
+        } else {
+            ExpressionList *args = arena.make<ExpressionList>();
+            args->push_back(make_expr(i));
+            args->push_back(arena.make<NUnaryOp>(TMINUS, *arena.make<NReal>(i * 0.5)));
+            body->push_back(arena.make<NPrintStatement>(*args));
+        }
+    }
+
+    NFunctionDecl *func = arena.make<NFunctionDecl>(*arena.make<NIdentifier>(Symbol::Intern("int")),
+        *arena.make<NIdentifier>(Symbol::Intern("main")), *arena.make<VariableList>(), *body);
+
+    StatementList *globals = arena.make<StatementList>();
+    StatementList *functions = arena.make<StatementList>();
+    functions->push_back(func);
+
+    return new NProgram(*globals, *functions);
+}
+
+/* -- Walk 1: sequential dynamic_casts, as the dispatchers used to do -- */
+
+struct WalkStats {
+    long long nodes;
+    long long checksum;
+};
+
+static void legacy_stmt(NStatement *stmt, WalkStats& stats);
+
+static void legacy_expr(NExpression *expr, WalkStats& stats)
+{
+    stats.nodes++;
+
+    if (dynamic_cast<NInteger*>(expr) != nullptr)
+        stats.checksum += dynamic_cast<NInteger*>(expr)->value;
+    else if (dynamic_cast<NReal*>(expr) != nullptr)
+        stats.checksum += 1;
+    else if (dynamic_cast<NStringLiteral*>(expr) != nullptr)
+        stats.checksum += 2;
+    else if (dynamic_cast<NIdentifier*>(expr) != nullptr)
+        stats.checksum += 3;
+    else if (dynamic_cast<NVariable*>(expr) != nullptr) {
+        NVariable *v = dynamic_cast<NVariable*>(expr);
+        stats.nodes++;
+        stats.checksum += v->identifier.name.id;
+        legacy_expr(v->arr_size, stats);
+    } else if (dynamic_cast<NFunctionCall*>(expr) != nullptr) {
+        NFunctionCall *c = dynamic_cast<NFunctionCall*>(expr);
+        for (size_t i = 0; i < c->arguments.size(); i++)
+            legacy_expr(c->arguments[i], stats);
+    } else if (dynamic_cast<NBinaryOp*>(expr) != nullptr) {
+        NBinaryOp *b = dynamic_cast<NBinaryOp*>(expr);
+        stats.checksum += b->op;
+        legacy_expr(b->lhs, stats);
+        legacy_expr(b->rhs, stats);
+    } else if (dynamic_cast<NUnaryOp*>(expr) != nullptr) {
+        NUnaryOp *u = dynamic_cast<NUnaryOp*>(expr);
+        stats.checksum += u->op;
+        legacy_expr(u->expr, stats);
+    }
+}
+
+static void legacy_stmt(NStatement *stmt, WalkStats& stats)
+{
+    stats.nodes++;
+
+    if (dynamic_cast<NAssignment*>(stmt) != nullptr) {
+        NAssignment *a = dynamic_cast<NAssignment*>(stmt);
+        legacy_expr(&a->lhs, stats);
+        legacy_expr(a->rhs, stats);
+    } else if (dynamic_cast<NExpressionStatement*>(stmt) != nullptr)
+        legacy_expr(dynamic_cast<NExpressionStatement*>(stmt)->expression, stats);
+    else if (dynamic_cast<NVariableDecl*>(stmt) != nullptr)
+        stats.checksum += 4;
+    else if (dynamic_cast<NVariableCompoundDecl*>(stmt) != nullptr)
+        stats.checksum += 5;
+    else if (dynamic_cast<NFunctionDecl*>(stmt) != nullptr) {
+        NFunctionDecl *f = dynamic_cast<NFunctionDecl*>(stmt);
+        for (size_t i = 0; i < f->body.size(); i++)
+            legacy_stmt(f->body[i], stats);
+    } else if (dynamic_cast<NIfStatement*>(stmt) != nullptr)
+        stats.checksum += 6;
+    else if (dynamic_cast<NForStatement*>(stmt) != nullptr)
+        stats.checksum += 7;
+    else if (dynamic_cast<NWhileStatement*>(stmt) != nullptr)
+        stats.checksum += 8;
+    else if (dynamic_cast<NPrintStatement*>(stmt) != nullptr) {
+        NPrintStatement *p = dynamic_cast<NPrintStatement*>(stmt);
+        for (size_t i = 0; i < p->arguments.size(); i++)
+            legacy_expr(p->arguments[i], stats);
+    } else if (dynamic_cast<NReadStatement*>(stmt) != nullptr)
+        stats.checksum += 9;
+    else if (dynamic_cast<NReturnStatement*>(stmt) != nullptr)
+        legacy_expr(dynamic_cast<NReturnStatement*>(stmt)->expression, stats);
+}
+
+/* -- Walk 2: one switch on the kind tag per node -- */
+
+class TagWalker {
+public:
+    WalkStats& stats;
+    TagWalker(WalkStats& stats) : stats(stats) { }
+
+    void walk(Node& node) { this->stats.nodes++; VisitNode(node, *this); }
+
+    void operator()(NInteger& n) { this->stats.checksum += n.value; }
+    void operator()(NReal& n) { this->stats.checksum += 1; }
+    void operator()(NStringLiteral& n) { this->stats.checksum += 2; }
+    void operator()(NIdentifier& n) { this->stats.checksum += 3; }
+    void operator()(NVariable& n) {
+        this->stats.nodes++;
+        this->stats.checksum += n.identifier.name.id;
+        this->walk(*n.arr_size);
+    }
+    void operator()(NFunctionCall& n) {
+        for (size_t i = 0; i < n.arguments.size(); i++)
+            this->walk(*n.arguments[i]);
+    }
+    void operator()(NBinaryOp& n) { this->stats.checksum += n.op; this->walk(*n.lhs); this->walk(*n.rhs); }
+    void operator()(NUnaryOp& n) { this->stats.checksum += n.op; this->walk(*n.expr); }
+    void operator()(NAssignment& n) { this->walk(n.lhs); this->walk(*n.rhs); }
+    void operator()(NExpressionStatement& n) { this->walk(*n.expression); }
+    void operator()(NVariableDecl& n) { this->stats.checksum += 4; }
+    void operator()(NVariableCompoundDecl& n) { this->stats.checksum += 5; }
+    void operator()(NFunctionDecl& n) {
+        for (size_t i = 0; i < n.body.size(); i++)
+            this->walk(*n.body[i]);
+    }
+    void operator()(NIfStatement& n) { this->stats.checksum += 6; }
+    void operator()(NForStatement& n) { this->stats.checksum += 7; }
+    void operator()(NWhileStatement& n) { this->stats.checksum += 8; }
+    void operator()(NPrintStatement& n) {
+        for (size_t i = 0; i < n.arguments.size(); i++)
+            this->walk(*n.arguments[i]);
+    }
+    void operator()(NReadStatement& n) { this->stats.checksum += 9; }
+    void operator()(NReturnStatement& n) { this->walk(*n.expression); }
+    void operator()(NProgram& n) { }
+    void operator()(NStatement& n) { }
+    void operator()(NExpression& n) { }
+};
+
+template <typename F>
+static double time_rounds(int rounds, F walk)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+        walk();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / rounds;
+}
+
+int main(int argc, char **argv)
+{
+    int statements = argc > 1 ? atoi(argv[1]) : 72000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 10;
+
+    NProgram *program = make_program(statements);
+    NStatement *func = program->function_decl_stmts[0];
+
+    WalkStats legacy = { 0, 0 }, tagged = { 0, 0 };
+
+    double t_legacy = time_rounds(rounds, [&]() { legacy_stmt(func, legacy); });
+    double t_tagged = time_rounds(rounds, [&]() { TagWalker(tagged).walk(*func); });
+
+    long long nodes = legacy.nodes / rounds;
+
+    if (legacy.checksum != tagged.checksum || legacy.nodes != tagged.nodes)
+        std::cout << "[WARN] walks disagree: " << legacy.nodes << "/" << tagged.nodes << " nodes" << std::endl;
+
+    printf("nodes per walk:      %lld\n", nodes);
+    printf("dynamic_cast chain:  %8.2f ms  (%5.2f ns/node)\n", t_legacy * 1e3, t_legacy * 1e9 / nodes);
+    printf("kind tag switch:     %8.2f ms  (%5.2f ns/node)\n", t_tagged * 1e3, t_tagged * 1e9 / nodes);
+    printf("pointer tree arena:  %8.2f MB\n", arena.BytesAllocated() / 1048576.0);
+
+    delete program;
+    return 0;
+}
@@ -0,0 +1,15 @@
+% Doubly recursive fibonacci: call overhead, no tail calls to remove
+var n: int;
+
+int func fib(k: int)
+    if k < 2 then
+        return k;
+    endif;
+    return fib(k - 1) + fib(k - 2);
+endfunc
+
+int func main()
+    n := 35;
+    print "fib(", n, ") = ", fib(n), "\n";
+    return 0;
+endfunc
@@ -0,0 +1,21 @@
+% Midpoint rule for the integral of 4 / (1 + x^2) over [0, 1], which is pi
+var steps: int;
+
+real func f(x: real)
+    return 4.0 / (1.0 + (x * x));
+endfunc
+
+int func main()
+    var i: int, h: real, x: real, sum: real;
+
+    steps := 20000000;
+    h := 1.0 / steps;
+    sum := 0.0;
+    for i := 0 to steps - 1
+        x := h * (i + 0.5);
+        sum := sum + f(x);
+    endfor;
+
+    print "pi ~ ", sum * h, "\n";
+    return 0;
+endfunc
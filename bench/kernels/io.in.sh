@@ -0,0 +1,2 @@
+# Input of io.v: a million pseudo-random integers below 100003
+awk 'BEGIN { n = 1000000; print n; for (i = 0; i < n; i++) print (i * 7919) % 100003 }'
@@ -0,0 +1,23 @@
+% Reads a count and that many integers, prints a running line every 1000 values
+var n: int;
+
+int func main()
+    var i: int, v: int, sum: int, max: int;
+
+    read n;
+    sum := 0;
+    max := 0;
+    for i := 1 to n
+        read v;
+        sum := sum + v;
+        if v > max then
+            max := v;
+        endif;
+        if (i mod 1000) = 0 then
+            print i, " ", v, " ", sum, " ", max, "\n";
+        endif;
+    endfor;
+
+    print "read ", n, " values, sum ", sum, ", max ", max, "\n";
+    return 0;
+endfunc
@@ -0,0 +1,32 @@
+% Dense integer matrix multiply, row-major in flat global arrays
+var a: int[90000], b: int[90000], c: int[90000];
+
+int func main()
+    var n: int, i: int, j: int, k: int, s: int, total: int;
+
+    n := 300;
+    for i := 0 to n - 1
+        for j := 0 to n - 1
+            a[(i * n) + j] := (i + j) mod 7;
+            b[(i * n) + j] := (i * j) mod 5;
+        endfor;
+    endfor;
+
+    for i := 0 to n - 1
+        for j := 0 to n - 1
+            s := 0;
+            for k := 0 to n - 1
+                s := s + (a[(i * n) + k] * b[(k * n) + j]);
+            endfor;
+            c[(i * n) + j] := s;
+        endfor;
+    endfor;
+
+    total := 0;
+    for i := 0 to (n * n) - 1
+        total := total + (c[i] * ((i mod 3) + 1));
+    endfor;
+
+    print "checksum ", total, ", c[0][0] ", c[0], ", c[n-1][n-1] ", c[(n * n) - 1], "\n";
+    return 0;
+endfunc
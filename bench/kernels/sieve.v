@@ -0,0 +1,47 @@
+% Sieve of Eratosthenes over a global array, repeated to get a measurable run time
+var flags: int[2000001], rounds: int;
+
+int func sieve(n: int)
+    var i: int, j: int, count: int;
+
+    for i := 2 to n
+        flags[i] := 1;
+    endfor;
+
+    i := 2;
+    while (i * i) <= n do
+        if flags[i] = 1 then
+            j := i * i;
+            while j <= n do
+                flags[j] := 0;
+                j := j + i;
+            endwhile;
+        endif;
+        i := i + 1;
+    endwhile;
+
+    count := 0;
+    for i := 2 to n
+        count := count + flags[i];
+    endfor;
+    return count;
+endfunc
+
+int func main()
+    var r: int, count: int, sum: int, i: int;
+
+    rounds := 10;
+    for r := 1 to rounds
+        count := sieve(2000000);
+    endfor;
+
+    sum := 0;
+    for i := 2 to 2000000
+        if flags[i] = 1 then
+            sum := sum + i;
+        endif;
+    endfor;
+
+    print "primes up to 2000000: ", count, ", sum ", sum, "\n";
+    return 0;
+endfunc
@@ -0,0 +1,66 @@
+#!/bin/sh
+# Runtime benchmark of the generated code: compiles every bench/kernels/*.v
+# into an executable at each optimization level, runs it (on the output of
+# <kernel>.in.sh when there is one), checks the output against <kernel>.out
+# and reports the wall-clock time. With a CSV file, results are appended to
+# it as date,commit,kernel,level,seconds,status so they can be tracked.
+#
+#   make bench-kernels
+#   sh bench/run_kernels.sh [compiler] [results.csv]
+
+COMPILER=${1:-./compiler}
+CSV=${2:-}
+LEVELS="0 1 2 3"
+
+KERNELS=$(cd "$(dirname "$0")/kernels" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+DATE=$(date +%Y-%m-%dT%H:%M:%S)
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+now() {
+    date +%s.%N
+}
+
+failures=0
+printf "%-12s %5s %10s  %s\n" kernel level seconds status
+
+for src in "$KERNELS"/*.v; do
+    name=$(basename "$src" .v)
+    input=/dev/null
+
+    if [ -f "$KERNELS/$name.in.sh" ]; then
+        input="$WORK/$name.in"
+        sh "$KERNELS/$name.in.sh" > "$input"
+    fi
+
+    for level in $LEVELS; do
+        cp "$src" "$WORK/$name.v"
+        rm -f "$WORK/$name"
+        seconds=-
+        status=ok
+
+        if ! "$COMPILER" -O$level --emit=exe "$WORK/$name.v" > "$WORK/compile.log" 2>&1; then
+            status="compile failed"
+        else
+            start=$(now)
+            "$WORK/$name" < "$input" > "$WORK/$name.out" 2>&1
+            end=$(now)
+            seconds=$(awk "BEGIN { printf \"%.3f\", $end - $start }")
+
+            if ! cmp -s "$WORK/$name.out" "$KERNELS/$name.out"; then
+                status="wrong output"
+            fi
+        fi
+
+        [ "$status" = ok ] || failures=$((failures + 1))
+        printf "%-12s %5s %10s  %s\n" "$name" "-O$level" "$seconds" "$status"
+
+        if [ -n "$CSV" ]; then
+            echo "$DATE,$COMMIT,$name,$level,$seconds,$status" >> "$CSV"
+        fi
+    done
+done
+
+[ $failures -eq 0 ]
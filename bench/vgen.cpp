@@ -0,0 +1,50 @@
+/*
+ * Writes a generated VLang program to stdout, see vgen.hpp.
+ *
+ *   make vgen && ./vgen [--seed=N] [--functions=N] [--depth=N] [--expr=N] [--globals=N] [--statements=N] > big.v
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+
+#include "vgen.hpp"
+
+static bool option(const char *arg, const char *name, long long *value)
+{
+    size_t len = strlen(name);
+
+    if (strncmp(arg, name, len) != 0 || arg[len] != '=')
+        return false;
+
+    *value = atoll(arg + len + 1);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    GeneratorOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        long long value;
+
+        if (option(argv[i], "--seed", &value))
+            options.seed = value;
+        else if (option(argv[i], "--functions", &value))
+            options.functions = value;
+        else if (option(argv[i], "--depth", &value))
+            options.depth = value;
+        else if (option(argv[i], "--expr", &value))
+            options.expr_size = value;
+        else if (option(argv[i], "--globals", &value))
+            options.globals = value;
+        else if (option(argv[i], "--statements", &value))
+            options.statements = value;
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--seed=N] [--functions=N] [--depth=N] [--expr=N] [--globals=N] [--statements=N]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << ProgramGenerator(options).Generate();
+    return 0;
+}
@@ -0,0 +1,204 @@
+#ifndef __VGEN_H
+#define __VGEN_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Seeded generator of valid VLang programs for the compile benchmarks. The
+ * same options give the same program on every platform. Programs scale in:
+ *   functions   top-level functions besides main
+ *   depth       nesting of if/for/while blocks inside each function
+ *   expr_size   binary operators per expression
+ *   globals     global int variables
+ *   statements  statements per block
+ * Every program also runs to completion: loops have constant trip counts,
+ * divisors are non-zero constants and a function only calls lower-numbered
+ * ones, once, outside any loop.
+ */
+struct GeneratorOptions {
+    uint64_t seed;
+    int functions;
+    int depth;
+    int expr_size;
+    int globals;
+    int statements;
+
+    GeneratorOptions() : seed(1), functions(10), depth(2), expr_size(4), globals(8), statements(4) { }
+};
+
+class ProgramGenerator {
+    GeneratorOptions options;
+    uint64_t state;
+    std::string out;
+    int indent;
+    std::vector<std::string> readable;      /* in scope: arguments, locals, loop counters, globals */
+    std::vector<std::string> writable;      /* the same without loop counters */
+
+    /* xorshift64*, so the output does not depend on the standard library */
+    uint64_t next() {
+        this->state ^= this->state >> 12;
+        this->state ^= this->state << 25;
+        this->state ^= this->state >> 27;
+        return this->state * 2685821657736338717ULL;
+    }
+
+    int pick(int n) { return n <= 1 ? 0 : int(this->next() % uint64_t(n)); }
+
+    void line(const std::string& text) {
+        this->out.append(this->indent * 4, ' ');
+        this->out += text;
+        this->out += '\n';
+    }
+
+    std::string expr(int size) {
+        static const char *ops[] = { "+", "-", "*", "+", "-" };
+
+        if (size <= 0) {
+            if (this->readable.empty() || this->pick(3) == 0)
+                return std::to_string(this->pick(100));
+            return this->readable[this->pick(this->readable.size())];
+        }
+
+        /* Operands are always parenthesized, binary operators associate to the right otherwise */
+        int kind = this->pick(7);
+        if (kind == 5 || kind == 6)
+            return "(" + this->expr(size - 1) + (kind == 5 ? " div " : " mod ") + std::to_string(1 + this->pick(9)) + ")";
+
+        int left = this->pick(size);
+        return "(" + this->expr(left) + " " + ops[kind] + " " + this->expr(size - 1 - left) + ")";
+    }
+
+    std::string condition() {
+        static const char *cmps[] = { "<", "<=", ">", ">=", "=", "<>" };
+        int half = this->options.expr_size / 2;
+
+        return "(" + this->expr(half) + " " + cmps[this->pick(6)] + " " + this->expr(half) + ")";
+    }
+
+    void block(int depth) {
+        for (int s = 0; s < this->options.statements; s++) {
+            int kind = this->pick(depth > 0 ? 6 : 3);
+
+            if (kind <= 1) {
+                this->line(this->writable[this->pick(this->writable.size())] + " := " + this->expr(this->options.expr_size) + ";");
+            } else if (kind == 2) {
+                this->line("print " + this->expr(this->options.expr_size) + ", \" \";");
+            } else if (kind == 3) {
+                this->line("if " + this->condition() + " then");
+                this->nested(depth);
+                if (this->pick(2) == 0) {
+                    this->line("else");
+                    this->nested(depth);
+                }
+                this->line("endif;");
+            } else if (kind == 4) {
+                std::string counter = "t" + std::to_string(depth);
+                this->line("for " + counter + " := 1 to " + std::to_string(1 + this->pick(3)));
+                this->readable.push_back(counter);
+                this->nested(depth);
+                this->readable.pop_back();
+                this->line("endfor;");
+            } else {
+                std::string counter = "w" + std::to_string(depth);
+                this->line(counter + " := 0;");
+                this->line("while " + counter + " < " + std::to_string(1 + this->pick(3)) + " do");
+                this->readable.push_back(counter);
+                this->nested(depth);
+                this->indent++;
+                this->line(counter + " := " + counter + " + 1;");
+                this->indent--;
+                this->readable.pop_back();
+                this->line("endwhile;");
+            }
+        }
+    }
+
+    void nested(int depth) {
+        this->indent++;
+        this->block(depth - 1);
+        this->indent--;
+    }
+
+    std::string call(int callee) {
+        std::string text = "f" + std::to_string(callee) + "(";
+        for (int a = 0; a < 1 + callee % 3; a++)
+            text += (a == 0 ? "" : ", ") + this->expr(1);
+        return text + ")";
+    }
+
+    void function(int index, const std::vector<std::string>& globals) {
+        int args = 1 + index % 3;
+        std::string header = "int func f" + std::to_string(index) + "(";
+        std::string locals = "var x0: int, x1: int";
+
+        this->readable = globals;
+        this->writable = globals;
+
+        for (int a = 0; a < args; a++) {
+            std::string name = "a" + std::to_string(a);
+            header += (a == 0 ? "" : ", ") + name + ": int";
+            this->readable.push_back(name);
+            this->writable.push_back(name);
+        }
+
+        for (int d = 1; d <= this->options.depth; d++)
+            locals += ", t" + std::to_string(d) + ": int, w" + std::to_string(d) + ": int";
+
+        this->line(header + ")");
+        this->indent++;
+        this->line(locals + ";");
+        this->line("x0 := a0;");
+        this->line("x1 := " + std::to_string(index) + ";");
+        this->readable.push_back("x0");
+        this->readable.push_back("x1");
+        this->writable.push_back("x0");
+        this->writable.push_back("x1");
+
+        this->block(this->options.depth);
+
+        if (index > 0)
+            this->line("x0 := x0 + " + this->call(this->pick(index)) + ";");
+        this->line("return " + this->expr(this->options.expr_size) + ";");
+        this->indent--;
+        this->line("endfunc");
+    }
+
+public:
+    ProgramGenerator(const GeneratorOptions& options) : options(options), indent(0) {
+        this->state = options.seed * 0x9E3779B97F4A7C15ULL + 1;
+        if (this->options.globals < 1)
+            this->options.globals = 1;
+        if (this->options.statements < 1)
+            this->options.statements = 1;
+    }
+
+    std::string Generate() {
+        std::vector<std::string> globals;
+        std::string decl = "var ";
+
+        for (int g = 0; g < this->options.globals; g++) {
+            globals.push_back("g" + std::to_string(g));
+            decl += (g == 0 ? "" : ", ") + globals.back() + ": int";
+        }
+        this->line(decl + ";");
+
+        for (int f = 0; f < this->options.functions; f++)
+            this->function(f, globals);
+
+        this->readable.clear();
+        this->writable.clear();
+        this->line("int func main()");
+        this->indent++;
+        for (int f = this->options.functions - 1; f >= 0 && f >= this->options.functions - 4; f--)
+            this->line("print " + this->call(f) + ", \"\\n\";");
+        this->line("return 0;");
+        this->indent--;
+        this->line("endfunc");
+
+        return this->out;
+    }
+};
+
+#endif
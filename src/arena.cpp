@@ -0,0 +1,44 @@
+#include <stdlib.h>
+#include <iostream>
+#include "arena.hpp"
+
+void *Arena::allocateSlow(size_t size, size_t align)
+{
+    /* Oversized requests get a chunk of their own */
+    size_t chunk_size = sizeof(Chunk) + size + align;
+    if (chunk_size < ARENA_CHUNK_SIZE)
+        chunk_size = ARENA_CHUNK_SIZE;
+
+    Chunk *chunk = static_cast<Chunk *>(malloc(chunk_size));
+    if (chunk == NULL) {
+        std::cout << std::endl << "[ERROR] Arena: out of memory" << std::endl;
+        abort();
+    }
+
+    chunk->prev = this->chunks;
+    chunk->size = chunk_size;
+    this->chunks = chunk;
+
+    this->cursor = reinterpret_cast<char *>(chunk + 1);
+    this->limit = reinterpret_cast<char *>(chunk) + chunk_size;
+
+    return this->allocate(size, align);
+}
+
+void Arena::release()
+{
+    for (Finalizer *fin = this->finalizers; fin != NULL; fin = fin->prev)
+        fin->destroy(fin->object);
+
+    Chunk *chunk = this->chunks;
+    while (chunk != NULL) {
+        Chunk *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+
+    this->chunks = NULL;
+    this->cursor = this->limit = NULL;
+    this->finalizers = NULL;
+    this->bytes_allocated = 0;
+}
@@ -0,0 +1,79 @@
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+#define ARENA_CHUNK_SIZE    (64 * 1024)
+
+/*
+ * Bump allocator for everything the parser builds during one compilation:
+ * AST nodes, the statement/expression/variable lists and token strings.
+ * Objects are never freed individually; destroying the arena runs the
+ * pending destructors (newest first) and releases all chunks in one shot.
+ */
+class Arena {
+    struct Chunk {
+        Chunk *prev;
+        size_t size;
+    };
+
+    struct Finalizer {
+        Finalizer *prev;
+        void (*destroy)(void *);
+        void *object;
+    };
+
+    Chunk *chunks;
+    char *cursor;
+    char *limit;
+    Finalizer *finalizers;
+    size_t bytes_allocated;
+
+    void *allocateSlow(size_t size, size_t align);
+
+    template <typename T>
+    static void destroyObject(void *object) { static_cast<T *>(object)->~T(); }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+public:
+    Arena() : chunks(NULL), cursor(NULL), limit(NULL), finalizers(NULL), bytes_allocated(0) { }
+    ~Arena() { this->release(); }
+
+    void *allocate(size_t size, size_t align) {
+        size_t pad = (align - (reinterpret_cast<size_t>(this->cursor) & (align - 1))) & (align - 1);
+
+        if (this->cursor == NULL || size + pad > size_t(this->limit - this->cursor))
+            return this->allocateSlow(size, align);
+
+        void *mem = this->cursor + pad;
+        this->cursor += size + pad;
+        this->bytes_allocated += size;
+        return mem;
+    }
+
+    /* Constructs a T inside the arena; its destructor runs on release() */
+    template <typename T, typename... Args>
+    T *make(Args&&... args) {
+        T *object = new (this->allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+
+        if (!std::is_trivially_destructible<T>::value) {
+            Finalizer *fin = new (this->allocate(sizeof(Finalizer), alignof(Finalizer))) Finalizer;
+            fin->prev = this->finalizers;
+            fin->destroy = &Arena::destroyObject<T>;
+            fin->object = object;
+            this->finalizers = fin;
+        }
+
+        return object;
+    }
+
+    void release();
+    size_t BytesAllocated() const { return this->bytes_allocated; }
+};
+
+#endif
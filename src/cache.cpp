@@ -0,0 +1,290 @@
+#include <string.h>
+#include <set>
+#include <atomic>
+#include <thread>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/SHA1.h>
+#include "cache.hpp"
+#include "codegen.hpp"
+#include "resolve.hpp"
+#include "simplify.hpp"
+#include "trace.hpp"
+
+static void err_and_halt(std::string msg) {
+    std::cout << std::endl << "[ERROR] " << msg << std::endl;
+    abort();
+}
+
+/* Feeds the shape and contents of a subtree to SHA-1 in pre-order; lists are prefixed with their length */
+class UnitHasher {
+public:
+    SHA1 sha;
+    std::set<Symbol> callees;
+
+    void add(uint64_t value) { this->sha.update(ArrayRef<uint8_t>(reinterpret_cast<const uint8_t *>(&value), sizeof(value))); }
+    void add(const std::string& text) { this->add(uint64_t(text.size())); this->sha.update(text); }
+
+    void walk(Node& node) {
+        this->add(uint64_t(node.kind));
+        VisitNode(node, *this);
+    }
+
+    void walk(StatementList& list) {
+        this->add(uint64_t(list.size()));
+        for (StatementList::iterator it = list.begin(); it != list.end(); it++)
+            this->walk(**it);
+    }
+
+    void walk(ExpressionList& list) {
+        this->add(uint64_t(list.size()));
+        for (ExpressionList::iterator it = list.begin(); it != list.end(); it++)
+            this->walk(**it);
+    }
+
+    void walk(VariableList& list) {
+        this->add(uint64_t(list.size()));
+        for (VariableList::iterator it = list.begin(); it != list.end(); it++)
+            this->walk(**it);
+    }
+
+    void operator()(NInteger& node) { this->add(uint64_t(node.value)); }
+
+    void operator()(NReal& node) {
+        uint64_t bits;
+        memcpy(&bits, &node.value, sizeof(bits));
+        this->add(bits);
+    }
+
+    void operator()(NStringLiteral& node) { this->add(node.value); }
+    void operator()(NIdentifier& node) { this->add(node.name.str()); }
+    void operator()(NVariable& node) { this->add(uint64_t(node.type)); this->walk(node.identifier); this->walk(*node.arr_size); }
+
+    void operator()(NFunctionCall& node) {
+        this->callees.insert(node.id.name);
+        this->walk(node.id);
+        this->walk(node.arguments);
+    }
+
+    void operator()(NBinaryOp& node) { this->add(uint64_t(node.op)); this->walk(*node.lhs); this->walk(*node.rhs); }
+    void operator()(NUnaryOp& node) { this->add(uint64_t(node.op)); this->walk(*node.expr); }
+    void operator()(NAssignment& node) { this->walk(node.lhs); this->walk(*node.rhs); }
+    void operator()(NExpressionStatement& node) { this->walk(*node.expression); }
+
+    void operator()(NVariableDecl& node) {
+        this->add(uint64_t(node.type));
+        this->add(uint64_t(node.arr_size));
+        this->walk(node.id);
+        this->walk(node.type_id);
+    }
+
+    void operator()(NVariableCompoundDecl& node) { this->walk(node.decls); }
+
+    void operator()(NFunctionDecl& node) {
+        this->addSignature(node);
+        this->walk(node.body);
+    }
+
+    void operator()(NIfStatement& node) {
+        this->walk(*node.condition);
+        this->walk(node.then_body);
+        this->walk(node.else_body);
+    }
+
+    void operator()(NForStatement& node) {
+        this->walk(node.iterator);
+        this->walk(*node.iter_assign);
+        this->walk(*node.iter_until);
+        this->walk(*node.iter_by);
+        this->walk(node.body);
+    }
+
+    void operator()(NWhileStatement& node) { this->walk(*node.condition); this->walk(node.body); }
+    void operator()(NPrintStatement& node) { this->walk(node.arguments); }
+    void operator()(NReadStatement& node) { this->walk(node.destinations); }
+    void operator()(NReturnStatement& node) { this->walk(*node.expression); }
+    void operator()(NProgram& node) { this->walk(node.variable_decl_stmts); this->walk(node.function_decl_stmts); }
+
+    /* The parser's placeholders for missing operands only count by their kind */
+    void operator()(NExpression& node) { }
+    void operator()(NStatement& node) { }
+
+    /* Only the header: return type, name and parameters */
+    void addSignature(NFunctionDecl& func) {
+        this->walk(func.type);
+        this->walk(func.id);
+        this->walk(func.arguments);
+    }
+};
+
+std::string HashFunctionUnit(NProgram& program, size_t function, const std::string& salt)
+{
+    UnitHasher hasher;
+
+    hasher.add(std::string(CACHE_VERSION));
+    hasher.add(salt);
+
+    hasher.walk(*program.function_decl_stmts[function]);
+
+    /* Calls are generated against the callee's prototype */
+    UnitHasher signatures;
+    StatementList::iterator it;
+    for (it = program.function_decl_stmts.begin(); it != program.function_decl_stmts.end(); it++) {
+        NFunctionDecl& func = static_cast<NFunctionDecl&>(**it);
+
+        if (hasher.callees.count(func.id.name))
+            signatures.addSignature(func);
+    }
+
+    /* Globals are few and resolve to slots by position, so all of them count */
+    signatures.walk(program.variable_decl_stmts);
+
+    hasher.add(toHex(signatures.sha.final()));
+    return toHex(hasher.sha.final(), true);
+}
+
+/* Best effort: a unit that cannot be cached is simply compiled again next time */
+static void write_cache_file(const std::string& path, const MemoryBuffer& code)
+{
+    SmallString<256> temp_path;
+    int fd;
+
+    if (sys::fs::createUniqueFile(path + ".tmp%%%%%%", fd, temp_path))
+        return;
+
+    {
+        raw_fd_ostream stream(fd, true);
+        stream << code.getBuffer();
+    }
+
+    /* Renaming is atomic, so concurrent compilers never see half a file */
+    if (sys::fs::rename(temp_path, path))
+        sys::fs::remove(temp_path);
+}
+
+/*
+ * Like generateCodeSharded, with one unit per top-level function whose
+ * optimized bitcode is kept in cache_dir under its HashFunctionUnit key.
+ * Only the functions whose key changed are generated again (on `threads`
+ * workers); globals and _start are always regenerated, they are cheap.
+ */
+void CodeGenContext::generateCodeCached(NProgram& root, std::string cache_dir, unsigned threads, int opt_level, bool time_passes, std::string options_key)
+{
+    if (ResolveNames(root) != 0)
+        err_and_halt("CodeGen<NProgram>: Name resolution failed");
+
+    this->simplify_rewrites = SimplifyProgram(root);
+
+    /* A different compiler build may generate different code for the same source */
+    std::string salt = std::string(VLC_BUILD_ID) + "|LLVM " LLVM_VERSION_STRING "|" + options_key;
+    salt += "|O" + std::to_string(opt_level) + (this->fast_math ? "|fast-math" : "");
+    salt += "|V" + std::to_string(this->vectorize_width) + "|U" + std::to_string(this->unroll_count);
+    if (this->target_machine != NULL)
+        salt += "|" + this->target_machine->getTargetTriple().str() + "|" + this->target_machine->getTargetCPU().str()
+            + "|" + this->target_machine->getTargetFeatureString().str() + "|O" + std::to_string(this->target_opt_level);
+
+    if (std::error_code code = sys::fs::create_directories(cache_dir))
+        err_and_halt("Cache: Cannot create " + cache_dir + ": " + code.message());
+
+    size_t num_functions = root.function_decl_stmts.size();
+
+    std::vector<std::string> paths(num_functions);
+    std::vector<std::unique_ptr<MemoryBuffer> > unit_code(num_functions);
+    std::vector<std::unique_ptr<Module> > unit_modules(num_functions);
+    std::vector<size_t> misses;
+
+    /* An entry that does not read back (truncated, corrupt, older bitcode) is a miss and gets replaced */
+    TraceScope *lookup_trace = new TraceScope("cache-lookup");
+    for (size_t i = 0; i < num_functions; i++) {
+        paths[i] = cache_dir + "/" + HashFunctionUnit(root, i, salt) + ".bc";
+
+        ErrorOr<std::unique_ptr<MemoryBuffer> > cached = MemoryBuffer::getFile(paths[i]);
+        if (cached) {
+            Expected<std::unique_ptr<Module> > cached_module = parseBitcodeFile((*cached)->getMemBufferRef(), *this->llvm_context);
+
+            if (cached_module) {
+                unit_modules[i] = std::move(*cached_module);
+                continue;
+            }
+            consumeError(cached_module.takeError());
+        }
+
+        misses.push_back(i);
+    }
+
+    delete lookup_trace;
+
+    this->cache_hits = num_functions - misses.size();
+    this->cache_misses = misses.size();
+
+    if (threads > misses.size())
+        threads = misses.size();
+
+    std::atomic<size_t> next_miss(0);
+    std::vector<std::thread> workers;
+
+    for (unsigned w = 0; w < threads; w++) {
+        workers.push_back(std::thread([&]() {
+            for (size_t m = next_miss++; m < misses.size(); m = next_miss++) {
+                size_t i = misses[m];
+
+                /* The unit's function stays external, who calls it may change without its key changing; nested ones are internal */
+                CodeGenContext unit;
+                unit.sharded = true;
+                unit.owns_globals = false;
+                unit.owned_functions.assign(num_functions, false);
+                unit.owned_functions[i] = true;
+
+                unit.fast_math = this->fast_math;
+                unit.vectorize_width = this->vectorize_width;
+                unit.unroll_count = this->unroll_count;
+                if (this->target_machine != NULL)
+                    unit.SetupTargetMachine(this->target_opt_level, this->target_host_cpu);
+
+                root.codeGen(unit);
+                unit.OptimizeModule(opt_level, time_passes);
+
+                /* Prototypes of functions it never calls are not part of the key, so they must not be part of the entry */
+                for (Module::iterator func = unit.module->begin(); func != unit.module->end(); ) {
+                    Function *decl = &*func++;
+                    if (decl->isDeclaration() && decl->use_empty())
+                        decl->eraseFromParent();
+                }
+
+                unit_code[i] = unit.GetBitcodeBuffer();
+
+                write_cache_file(paths[i], *unit_code[i]);
+            }
+        }));
+    }
+
+    for (size_t w = 0; w < workers.size(); w++)
+        workers[w].join();
+
+    /* This module gets the globals, the prototypes and _start, then every unit is linked in */
+    this->sharded = true;
+    this->owns_globals = true;
+    this->owned_functions.assign(num_functions, false);
+    root.codeGen(*this);
+
+    TraceScope trace("merge");
+
+    /* One linker for all units, it would rescan the whole module each time otherwise */
+    Linker linker(*this->module);
+
+    for (size_t i = 0; i < num_functions; i++) {
+        /* Units generated in this run are read back here, cached ones were read during the lookup */
+        if (unit_modules[i] == NULL) {
+            Expected<std::unique_ptr<Module> > unit_module = parseBitcodeFile(unit_code[i]->getMemBufferRef(), *this->llvm_context);
+
+            if (!unit_module)
+                err_and_halt("Cache: Cannot read back the code generated for " + paths[i] + ": " + toString(unit_module.takeError()));
+            unit_modules[i] = std::move(*unit_module);
+        }
+
+        if (linker.linkInModule(std::move(unit_modules[i])))
+            err_and_halt("Cache: Cannot link " + paths[i]);
+    }
+
+    internalizeModule(*this->module, [](const GlobalValue& value) { return value.getName() == START_FUNC; });
+}
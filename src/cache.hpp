@@ -0,0 +1,31 @@
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include <string>
+#include "node.hpp"
+
+#define CACHE_DIR       ".vlcache"
+
+/* Bump whenever codegen changes what a function compiles to, so stale entries are never hit */
+#define CACHE_VERSION   "7"
+
+/*
+ * Part of every key, so entries written by another build of the compiler are
+ * never used. The Makefile passes a hash of the compiler's sources; a build
+ * without it shares "unknown" with every other such build.
+ */
+#ifndef VLC_BUILD_ID
+#define VLC_BUILD_ID    "unknown"
+#endif
+
+/*
+ * Cache key of one top-level function's optimized code: its subtree, the
+ * signatures of the functions it calls, the globals and the salt (compiler
+ * build, LLVM version, options and target). Names enter by spelling, not by symbol id, so keys
+ * are stable across runs. Nested functions are part of the subtree, so
+ * they are keyed together with the function that encloses them and whose
+ * name their symbols carry.
+ */
+std::string HashFunctionUnit(NProgram& program, size_t function, const std::string& salt);
+
+#endif
@@ -1,8 +1,17 @@
 #include "node.hpp"
 #include "codegen.hpp"
+#include "resolve.hpp"
+#include "simplify.hpp"
 #include "parser.hpp"
+#include "runtime.hpp"
+#include "trace.hpp"
 
 #include <stdlib.h>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/IR/Intrinsics.h>
 
 #define ADDRSPC 0
 
@@ -29,87 +38,667 @@ static Function* printf_prototype(LLVMContext& ctx, Module *mod)
     return func;
 }
 
+/* Target registration touches global registries, so it happens once per process */
+static void initialize_native_target()
+{
+    static std::once_flag initialized;
+
+    std::call_once(initialized, []() {
+        InitializeNativeTarget();
+        InitializeNativeTargetAsmPrinter();
+    });
+}
+
+/* Declares the runtime's readers, see runtime.hpp */
+static void runtime_prototypes(CodeGenContext& context)
+{
+    FunctionType *read_int_type = FunctionType::get(context.GetIntegerType(), false);
+    FunctionType *read_real_type = FunctionType::get(context.GetRealType(), false);
+
+    Function::Create(read_int_type, Function::ExternalLinkage, READ_INT_FUNC, context.module);
+    Function::Create(read_real_type, Function::ExternalLinkage, READ_REAL_FUNC, context.module);
+}
+
 /* Compile the AST into a module */
 void CodeGenContext::generateCode(NProgram& root)
 {
+    if (ResolveNames(root) != 0)
+        err_and_halt("CodeGen<NProgram>: Name resolution failed");
+
+    this->simplify_rewrites = SimplifyProgram(root);
+
     root.codeGen(*this);
 }
 
-/* Executes the AST by running the main function */
-void CodeGenContext::runCode() {
-    this->module->print(outs(), nullptr);
+/* Finds the functions that are called from a shard other than the one defining them */
+class ShardCallCollector {
+public:
+    unsigned caller_shard;
+    std::unordered_map<Symbol, unsigned>& owners;
+    StringSet<>& exported;
+
+    ShardCallCollector(std::unordered_map<Symbol, unsigned>& owners, StringSet<>& exported) :
+        caller_shard(0), owners(owners), exported(exported) { }
+
+    void walk(Node& node) { VisitNode(node, *this); }
+
+    void walk(StatementList& list) {
+        for (StatementList::iterator it = list.begin(); it != list.end(); it++)
+            this->walk(**it);
+    }
+
+    void walk(ExpressionList& list) {
+        for (ExpressionList::iterator it = list.begin(); it != list.end(); it++)
+            this->walk(**it);
+    }
+
+    void operator()(NFunctionCall& node) {
+        std::unordered_map<Symbol, unsigned>::iterator owner = this->owners.find(node.id.name);
+        if (owner != this->owners.end() && owner->second != this->caller_shard)
+            this->exported.insert(node.id.name.str());
+
+        this->walk(node.arguments);
+    }
+
+    void operator()(NVariable& node) { this->walk(*node.arr_size); }
+    void operator()(NBinaryOp& node) { this->walk(*node.lhs); this->walk(*node.rhs); }
+    void operator()(NUnaryOp& node) { this->walk(*node.expr); }
+    void operator()(NAssignment& node) { this->walk(node.lhs); this->walk(*node.rhs); }
+    void operator()(NExpressionStatement& node) { this->walk(*node.expression); }
+    void operator()(NFunctionDecl& node) { this->walk(node.body); }
+
+    void operator()(NIfStatement& node) {
+        this->walk(*node.condition);
+        this->walk(node.then_body);
+        this->walk(node.else_body);
+    }
+
+    void operator()(NForStatement& node) {
+        this->walk(node.iterator);
+        this->walk(*node.iter_assign);
+        this->walk(*node.iter_until);
+        this->walk(*node.iter_by);
+        this->walk(node.body);
+    }
+
+    void operator()(NWhileStatement& node) { this->walk(*node.condition); this->walk(node.body); }
+    void operator()(NPrintStatement& node) { this->walk(node.arguments); }
+    void operator()(NReadStatement& node) { this->walk(node.destinations); }
+    void operator()(NReturnStatement& node) { this->walk(*node.expression); }
+    void operator()(NProgram& node) { this->walk(node.function_decl_stmts); }
+
+    /* Literals, names, declarations and placeholders contain no calls */
+    void operator()(NInteger& node) { }
+    void operator()(NReal& node) { }
+    void operator()(NStringLiteral& node) { }
+    void operator()(NIdentifier& node) { }
+    void operator()(NVariableDecl& node) { }
+    void operator()(NVariableCompoundDecl& node) { }
+    void operator()(NExpression& node) { }
+    void operator()(NStatement& node) { }
+};
+
+/*
+ * Splits the top-level functions over `shards` threads. Each thread generates
+ * its share into its own context and module, next to declarations of every
+ * global and function, and optimizes it; the shards are then carried over to
+ * this context as bitcode and linked together. Inlining across shards is
+ * lost, so this trades some code quality for wall-clock time.
+ */
+void CodeGenContext::generateCodeSharded(NProgram& root, unsigned shards, int opt_level, bool time_passes)
+{
+    if (ResolveNames(root) != 0)
+        err_and_halt("CodeGen<NProgram>: Name resolution failed");
+
+    this->simplify_rewrites = SimplifyProgram(root);
+
+    if (shards > root.function_decl_stmts.size())
+        shards = root.function_decl_stmts.size();
+
+    if (shards <= 1) {
+        root.codeGen(*this);
+        this->OptimizeModule(opt_level, time_passes);
+        return;
+    }
+
+    /*
+     * Everything a shard defines is external so the others can reach it. The
+     * functions nobody else calls go back to internal before optimization,
+     * otherwise the optimizer could not drop or specialize them.
+     */
+    std::unordered_map<Symbol, unsigned> owners;
+    StringSet<> exported;
+
+    for (size_t i = 0; i < root.function_decl_stmts.size(); i++)
+        owners[static_cast<NFunctionDecl*>(root.function_decl_stmts[i])->id.name] = i % shards;
+
+    ShardCallCollector collector(owners, exported);
+    for (size_t i = 0; i < root.function_decl_stmts.size(); i++) {
+        collector.caller_shard = i % shards;
+        collector.walk(*root.function_decl_stmts[i]);
+    }
+
+    exported.insert(ROOT_FUNC);
+
+    /* The AST is only read from here on, so the shards can share it */
+    std::vector<std::unique_ptr<MemoryBuffer> > shard_code(shards);
+    std::vector<std::thread> workers;
+
+    for (unsigned i = 0; i < shards; i++) {
+        workers.push_back(std::thread([&, i]() {
+            CodeGenContext shard;
+            shard.sharded = true;
+            shard.owns_globals = (i == 0);
+            shard.owned_functions.resize(root.function_decl_stmts.size());
+
+            for (size_t f = 0; f < shard.owned_functions.size(); f++)
+                shard.owned_functions[f] = (f % shards == i);
+
+            shard.fast_math = this->fast_math;
+            shard.vectorize_width = this->vectorize_width;
+            shard.unroll_count = this->unroll_count;
+            if (this->target_machine != NULL)
+                shard.SetupTargetMachine(this->target_opt_level, this->target_host_cpu);
+
+            root.codeGen(shard);
+
+            for (Module::iterator func = shard.module->begin(); func != shard.module->end(); func++) {
+                if (!func->isDeclaration() && func->getName() != START_FUNC && !exported.count(func->getName()))
+                    func->setLinkage(GlobalValue::InternalLinkage);
+            }
+
+            shard.OptimizeModule(opt_level, time_passes);
+            shard_code[i] = shard.GetBitcodeBuffer();
+        }));
+    }
+
+    for (unsigned i = 0; i < shards; i++)
+        workers[i].join();
+
+    TraceScope trace("merge");
+
+    /* Linked in shard order, so the result does not depend on thread timing */
+    for (unsigned i = 0; i < shards; i++) {
+        Expected<std::unique_ptr<Module> > shard_module = parseBitcodeFile(shard_code[i]->getMemBufferRef(), *this->llvm_context);
+
+        if (!shard_module)
+            err_and_halt("CodeGen<NProgram>: Cannot read back shard " + std::to_string(i) + ": " + toString(shard_module.takeError()));
+
+        if (Linker::linkModules(*this->module, std::move(*shard_module)))
+            err_and_halt("CodeGen<NProgram>: Cannot link shard " + std::to_string(i));
+    }
+
+    /* Back to a single unit: only _start has to stay visible */
+    internalizeModule(*this->module, [](const GlobalValue& value) { return value.getName() == START_FUNC; });
+}
+
+/* JIT-compiles the module with ORC and runs _start in-process, returns the program's exit status */
+int CodeGenContext::runCode(bool print_times)
+{
+    initialize_native_target();
+
+    std::chrono::steady_clock::time_point jit_start = std::chrono::steady_clock::now();
+
+    Expected<std::unique_ptr<orc::LLJIT>> jit = orc::LLJITBuilder().create();
+    if (!jit)
+        err_and_halt("JIT: " + toString(jit.takeError()));
+
+    /* printf and friends come from the compiler process itself */
+    const DataLayout& layout = (*jit)->getDataLayout();
+    (*jit)->getMainJITDylib().addGenerator(
+        cantFail(orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(layout.getGlobalPrefix())));
+
+    /* The runtime is linked into the compiler, hand its addresses to the JIT */
+    orc::MangleAndInterner mangle((*jit)->getExecutionSession(), layout);
+    orc::SymbolMap runtime_symbols;
+    runtime_symbols[mangle(READ_INT_FUNC)] = JITEvaluatedSymbol(pointerToJITTargetAddress(&vl_read_int), JITSymbolFlags::Exported);
+    runtime_symbols[mangle(READ_REAL_FUNC)] = JITEvaluatedSymbol(pointerToJITTargetAddress(&vl_read_real), JITSymbolFlags::Exported);
+    runtime_symbols[mangle(PROFILE_WRITE_FUNC)] = JITEvaluatedSymbol(pointerToJITTargetAddress(&vl_profile_write), JITSymbolFlags::Exported);
+
+    if (Error error = (*jit)->getMainJITDylib().define(orc::absoluteSymbols(runtime_symbols)))
+        err_and_halt("JIT: " + toString(std::move(error)));
+
+    this->module->setDataLayout(layout);
+
+    /* The JIT takes over the module and its context */
+    orc::ThreadSafeModule jit_module(std::unique_ptr<Module>(this->module), std::unique_ptr<LLVMContext>(this->llvm_context));
+    this->module = NULL;
+    this->llvm_context = NULL;
+
+    if (Error error = (*jit)->addIRModule(std::move(jit_module)))
+        err_and_halt("JIT: " + toString(std::move(error)));
+
+    Expected<JITEvaluatedSymbol> start_sym = (*jit)->lookup(START_FUNC);
+    if (!start_sym)
+        err_and_halt("JIT: " + toString(start_sym.takeError()));
+
+    int64_t (*start_func)() = (int64_t (*)()) start_sym->getAddress();
+
+    std::chrono::steady_clock::time_point run_start = std::chrono::steady_clock::now();
+    int64_t ret_val = start_func();
+    std::chrono::steady_clock::time_point run_end = std::chrono::steady_clock::now();
+
+    if (Trace::Enabled()) {
+        int64_t run_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(run_end - run_start).count();
+        int64_t jit_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(run_start - jit_start).count();
+        int64_t now = Trace::Now();
+
+        Trace::Add("jit", TRACE_PHASE, now - run_ns - jit_ns, jit_ns, NULL);
+        Trace::Add("run", TRACE_PHASE, now - run_ns, run_ns, NULL);
+    }
+
+    fflush(stdout);
+
+    if (print_times) {
+        std::chrono::duration<double, std::milli> jit_time = run_start - jit_start;
+        std::chrono::duration<double, std::milli> run_time = run_end - run_start;
+        std::cerr << "[TIME] jit: " << jit_time.count() << " ms, run: " << run_time.count() << " ms" << std::endl;
+    }
+
+    return (int) ret_val;
+}
+
+/* Runs the new pass manager's default -O<level> pipeline over the module */
+void CodeGenContext::OptimizeModule(int level, bool time_passes)
+{
+    static const OptimizationLevel levels[] = {
+        OptimizationLevel::O0, OptimizationLevel::O1, OptimizationLevel::O2, OptimizationLevel::O3
+    };
+
+    TraceScope trace("optimize");
+
+    if (level < 0 || level > MAX_OPT_LEVEL)
+        err_and_halt("Optimizer: Unsupported optimization level " + std::to_string(level));
+
+    if (verifyModule(*this->module, &errs()))
+        err_and_halt("Optimizer: Generated module is malformed, refusing to optimize it");
+
+    LoopAnalysisManager lam;
+    FunctionAnalysisManager fam;
+    CGSCCAnalysisManager cgam;
+    ModuleAnalysisManager mam;
+
+    PassInstrumentationCallbacks pic;
+    TimePassesHandler pass_timer(time_passes);
+    pass_timer.registerCallbacks(pic);
+
+    PipelineTuningOptions tuning;
+    tuning.LoopVectorization = level >= 2;
+    tuning.SLPVectorization = level >= 2;
+
+    /* With a target machine the cost models see the real CPU, see SetupTargetMachine */
+    PassBuilder builder(this->target_machine, tuning, None, &pic);
+    builder.registerModuleAnalyses(mam);
+    builder.registerCGSCCAnalyses(cgam);
+    builder.registerFunctionAnalyses(fam);
+    builder.registerLoopAnalyses(lam);
+    builder.crossRegisterProxies(lam, fam, cgam, mam);
+
+    ModulePassManager passes = (level == 0)
+        ? builder.buildO0DefaultPipeline(levels[level])
+        : builder.buildPerModuleDefaultPipeline(levels[level]);
+
+    passes.run(*this->module, mam);
+}
+
+/* Targets the host triple, either generic for its architecture or the exact host CPU and features */
+void CodeGenContext::SetupTargetMachine(int opt_level, bool host_cpu)
+{
+    static const CodeGenOpt::Level levels[] = {
+        CodeGenOpt::None, CodeGenOpt::Less, CodeGenOpt::Default, CodeGenOpt::Aggressive
+    };
+
+    if (opt_level < 0 || opt_level > MAX_OPT_LEVEL)
+        err_and_halt("Target: Unsupported optimization level " + std::to_string(opt_level));
+
+    initialize_native_target();
+
+    std::string triple = sys::getDefaultTargetTriple();
+    std::string error;
+    const Target *target = TargetRegistry::lookupTarget(triple, error);
+
+    if (target == NULL)
+        err_and_halt("Target: " + error);
+
+    std::string cpu = "generic";
+    SubtargetFeatures features;
+
+    if (host_cpu) {
+        cpu = sys::getHostCPUName().str();
+
+        StringMap<bool> host_features;
+        if (sys::getHostCPUFeatures(host_features)) {
+            for (StringMap<bool>::iterator it = host_features.begin(); it != host_features.end(); it++)
+                features.AddFeature(it->getKey(), it->getValue());
+        }
+    }
+
+    /* Lets the backend fuse a multiply and an add the IR marked as contractable into an FMA */
+    TargetOptions options;
+    if (this->fast_math)
+        options.AllowFPOpFusion = FPOpFusion::Fast;
+
+    delete this->target_machine;
+    this->target_machine = target->createTargetMachine(triple, cpu, features.getString(),
+        options, Reloc::PIC_, None, levels[opt_level]);
+
+    if (this->target_machine == NULL)
+        err_and_halt("Target: Cannot create a target machine for " + triple);
+
+    this->target_opt_level = opt_level;
+    this->target_host_cpu = host_cpu;
+    this->module->setTargetTriple(triple);
+    this->module->setDataLayout(this->target_machine->createDataLayout());
+}
+
+/* Adds the C entry point of an executable, int main() { return _start(); } */
+void CodeGenContext::AddHostEntryPoint()
+{
+    /* The VLang main is internal, so it can give its name up to the C one */
+    Function *vlang_main = this->module->getFunction(ROOT_FUNC);
+    if (vlang_main != NULL)
+        vlang_main->setName(VLANG_MAIN);
+
+    Function *start_func = this->module->getFunction(START_FUNC);
+    if (start_func == NULL)
+        err_and_halt("Target: Module has no " START_FUNC " function");
+
+    /* crt1.o brings its own _start, ours is only reached through main */
+    start_func->setLinkage(GlobalValue::InternalLinkage);
+
+    FunctionType *ftype = FunctionType::get(Type::getInt32Ty(*this->llvm_context), false);
+    Function *host_main = Function::Create(ftype, GlobalValue::ExternalLinkage, HOST_MAIN, this->module);
+    BasicBlock *entry_block = BasicBlock::Create(*this->llvm_context, INTRO_CTX, host_main);
+
+    Value *ret_val = CallInst::Create(start_func, "", entry_block);
+    ReturnInst::Create(*this->llvm_context, new TruncInst(ret_val, Type::getInt32Ty(*this->llvm_context), "", entry_block), entry_block);
+}
+
+/* Writes a relocatable object file for the target set up by SetupTargetMachine */
+void CodeGenContext::EmitObjectFile(std::string filename)
+{
+    TraceScope trace("emit", TRACE_PHASE, filename.c_str());
+
+    if (this->target_machine == NULL)
+        err_and_halt("Target: No target machine to emit " + filename + " for");
+
+    std::error_code code;
+    raw_fd_ostream stream(filename, code, sys::fs::OF_None);
+
+    if (code)
+        err_and_halt("Target: Cannot open " + filename + ": " + code.message());
+
+    legacy::PassManager passes;
+    if (this->target_machine->addPassesToEmitFile(passes, stream, nullptr, CGFT_ObjectFile))
+        err_and_halt("Target: The target cannot emit object files");
+
+    passes.run(*this->module);
+    stream.flush();
 }
 
 void CodeGenContext::SaveIRToFile(std::string filename) {
+    TraceScope trace("emit", TRACE_PHASE, filename.c_str());
     std::error_code code;
     raw_fd_ostream stream(filename, code);
     this->module->print(stream, nullptr);
 }
 
+void CodeGenContext::SaveBitcodeToFile(std::string filename)
+{
+    TraceScope trace("emit", TRACE_PHASE, filename.c_str());
+
+    std::error_code code;
+    raw_fd_ostream stream(filename, code, sys::fs::OF_None);
+
+    if (code)
+        err_and_halt("Bitcode: Cannot open " + filename + ": " + code.message());
+
+    WriteBitcodeToFile(*this->module, stream);
+}
+
+/* Serializes the module to bitcode in memory, for tools that load it with parseBitcodeFile */
+std::unique_ptr<MemoryBuffer> CodeGenContext::GetBitcodeBuffer()
+{
+    SmallVector<char, 0> buffer;
+    raw_svector_ostream stream(buffer);
+
+    WriteBitcodeToFile(*this->module, stream);
+
+    return std::unique_ptr<MemoryBuffer>(new SmallVectorMemoryBuffer(std::move(buffer), this->module->getName()));
+}
+
+/* Returns an i8* to a NUL-terminated copy of text; equal strings share one global per module */
+Constant *CodeGenContext::GetStringConstant(StringRef text)
+{
+    GlobalVariable *&var = this->string_constants[text];
+
+    if (var == NULL) {
+        Constant *str_const = ConstantDataArray::getString(*this->llvm_context, text);
+        var = new GlobalVariable(*this->module, str_const->getType(), true,
+            GlobalValue::PrivateLinkage, str_const, ".str");
+        var->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+    }
+
+    Constant *zero = Constant::getNullValue(this->integer_type);
+    Constant *indices[] = { zero, zero };
+
+    return ConstantExpr::getInBoundsGetElementPtr(var->getValueType(), var, indices);
+}
+
+/* Returns the function called `name`, declaring a top-level one the first time; NULL if there is none */
+Function *CodeGenContext::GetFunction(Symbol name)
+{
+    std::unordered_map<Symbol, Function*>::iterator func = this->functions.find(name);
+    if (func != this->functions.end())
+        return func->second;
+
+    std::unordered_map<Symbol, NFunctionDecl*>::iterator decl = this->function_decls.find(name);
+    if (decl == this->function_decls.end())
+        return NULL;
+
+    return decl->second->codeGenPrototype(*this);
+}
+
 /* Returns an LLVM type based on the identifier */
 static Type *typeOf(const NIdentifier& type, CodeGenContext& ctx) 
 {
-    if (type.name == "int") {
+    static const Symbol integer_id = Symbol::Intern(INTEGER_ID);
+    static const Symbol real_id = Symbol::Intern(FLOAT_ID);
+
+    if (type.name == integer_id) {
         return ctx.GetIntegerType();
     }
-    else if (type.name == "real") {
+    else if (type.name == real_id) {
         
         return ctx.GetRealType();
     }
 
-    err_and_halt("CodegenError<NIdentifier>: Unknown type identifier " + type.name);
+    err_and_halt("CodegenError<NIdentifier>: Unknown type identifier " + type.name.str());
+}
+
+/* Returns the storage a resolved variable name is bound to */
+static Value *slotOf(const NIdentifier& id, CodeGenContext& context)
+{
+    Value *slot = NULL;
+
+    if (id.binding.scope == BINDING_LOCAL)
+        slot = context.local_slots[id.binding.index];
+    else if (id.binding.scope == BINDING_GLOBAL)
+        slot = context.global_slots[id.binding.index];
+
+    if (slot == NULL)
+        err_and_halt("undeclared variable " + id.name.str());
+
+    return slot;
+}
+
+/* Returns the type of the value held in a variable slot */
+static Type *slotType(Value *slot)
+{
+    if (AllocaInst *alloc = dyn_cast<AllocaInst>(slot))
+        return alloc->getAllocatedType();
+
+    return cast<GlobalVariable>(slot)->getValueType();
+}
+
+/* Returns the address of a variable or of the array element it names */
+static Value *addressOf(NVariable& var, CodeGenContext& context, Type *&elem_type)
+{
+    Value *slot = slotOf(var.identifier, context);
+    Type *slot_type = slotType(slot);
+
+    if (var.type == VARIABLE_BASIC) {
+        elem_type = slot_type;
+        return slot;
+    } else if (var.type != VARIABLE_ARRAY)
+        err_and_halt("CodeGen<NVariable>: Undefined type attribute: " + std::to_string(var.type) + "(" + var.identifier.name.str() + ")");
+
+    Value* arr_index_val = var.arr_size->codeGen(context);
+
+    if (arr_index_val->getType() != context.GetIntegerType())
+        err_and_halt("CodeGen<NVariable>: Non-integer array index (" + var.identifier.name.str() + ")");
+
+    std::vector<Value*> index_vect;
+
+    if (slot_type->isPointerTy()) {
+        /* Unsized arrays (a: int[]) hold a pointer to their first element */
+        elem_type = slot_type->getPointerElementType();
+        Value *base = new LoadInst(slot_type, slot, "", false, context.currentBlock());
+        index_vect.push_back(arr_index_val);
+        return GetElementPtrInst::CreateInBounds(elem_type, base, index_vect, "", context.currentBlock());
+    }
+
+    elem_type = slot_type->getArrayElementType();
+    index_vect.push_back(ConstantInt::get(context.GetIntegerType(), 0));
+    index_vect.push_back(arr_index_val);
+    return GetElementPtrInst::CreateInBounds(slot_type, slot, index_vect, "", context.currentBlock());
+}
+
+/* Converts between the integer and real representations of a value */
+static Value *convertTo(Value *val, Type *type, CodeGenContext& context)
+{
+    Type *from = val->getType();
+
+    if (from == type)
+        return val;
+    else if (from->isIntegerTy() && type->isDoubleTy())
+        return new SIToFPInst(val, type, "", context.currentBlock());
+    else if (from->isDoubleTy() && type->isIntegerTy())
+        return new FPToSIInst(val, type, "", context.currentBlock());
+    else if (from->isIntegerTy() && type->isIntegerTy())
+        return CastInst::CreateIntegerCast(val, type, !from->isIntegerTy(1), "", context.currentBlock());
+
+    return val;
+}
+
+/* Branches take an i1: an int or a real is true when it is not zero */
+static Value *truthValue(Value *val, CodeGenContext& context)
+{
+    Type *type = val->getType();
+
+    if (type->isDoubleTy())
+        return new FCmpInst(*context.currentBlock(), CmpInst::Predicate::FCMP_UNE, val, ConstantFP::get(type, 0.0), "");
+    else if (type->isIntegerTy() && !type->isIntegerTy(1))
+        return new ICmpInst(*context.currentBlock(), CmpInst::Predicate::ICMP_NE, val, ConstantInt::get(type, 0), "");
+
+    return val;
+}
+
+/*
+ * Allocates a local in the entry block of the current function, after the
+ * allocas already there: mem2reg only promotes entry block allocas, and one
+ * in a loop body would grow the stack on every iteration.
+ */
+static AllocaInst *entryAlloca(Type *type, const std::string& name, CodeGenContext& context)
+{
+    BasicBlock& entry = context.curr_func->getEntryBlock();
+    BasicBlock::iterator pos = entry.begin();
+
+    while (pos != entry.end() && isa<AllocaInst>(*pos))
+        pos++;
+
+    if (pos == entry.end())
+        return new AllocaInst(type, ADDRSPC, name, &entry);
+    return new AllocaInst(type, ADDRSPC, name, &*pos);
+}
+
+/*
+ * Under --fast-math a floating-point result may be reassociated, contracted
+ * into an FMA and computed with reciprocals, which lets the vectorizer split
+ * real reductions. NaNs and infinities keep their meaning.
+ */
+static Value *fastMath(Value *val, CodeGenContext& context)
+{
+    if (context.fast_math && isa<FPMathOperator>(val)) {
+        FastMathFlags flags;
+        flags.setAllowReassoc();
+        flags.setAllowContract();
+        flags.setAllowReciprocal();
+        flags.setNoSignedZeros();
+        cast<Instruction>(val)->setFastMathFlags(flags);
+    }
+    return val;
+}
+
+/* Generates a statement list; anything after a return in the same block is dead and skipped */
+static void genStatements(StatementList& stmts, CodeGenContext& context)
+{
+    StatementList::const_iterator it;
+    for (it = stmts.begin(); it != stmts.end(); it++) {
+        if (context.currentBlock()->getTerminator() != NULL)
+            break;
+
+        (**it).codeGen(context);
+    }
+}
+
+/* Returns the text of a string literal token: quotes stripped and escapes resolved */
+static std::string unquote(const std::string& literal)
+{
+    std::string text;
+
+    for (size_t i = 1; i + 1 < literal.length(); i++) {
+        char c = literal[i];
+
+        if (c == '\\' && i + 2 < literal.length()) {
+            c = literal[++i];
+
+            if (c == 'n')
+                c = '\n';
+            else if (c == 't')
+                c = '\t';
+        }
+
+        text += c;
+    }
+
+    return text;
 }
 
 /* -- Code Generation -- */
 
+/* Forwards to the concrete class' codeGen without another virtual lookup */
+class CodeGenVisitor {
+    CodeGenContext& context;
+
+public:
+    CodeGenVisitor(CodeGenContext& context) : context(context) { }
+
+    template <typename T>
+    Value* operator()(T& node) { return node.T::codeGen(this->context); }
+
+    Value* operator()(NExpression& node) { return NULL; }
+    Value* operator()(NStatement& node) { return NULL; }
+};
+
 Value* NExpression::codeGen(CodeGenContext& context)
 { 
-    if (dynamic_cast<NInteger*>(this) != nullptr)
-        return dynamic_cast<NInteger*>(this)->codeGen(context);
-    else if (dynamic_cast<NReal*>(this) != nullptr)
-        return dynamic_cast<NReal*>(this)->codeGen(context);
-    else if (dynamic_cast<NStringLiteral*>(this) != nullptr)
-        return dynamic_cast<NStringLiteral*>(this)->codeGen(context);
-    else if (dynamic_cast<NIdentifier*>(this) != nullptr)
-        return dynamic_cast<NIdentifier*>(this)->codeGen(context);
-    else if (dynamic_cast<NVariable*>(this) != nullptr)
-        return dynamic_cast<NVariable*>(this)->codeGen(context);
-    else if (dynamic_cast<NFunctionCall*>(this) != nullptr)
-        return dynamic_cast<NFunctionCall*>(this)->codeGen(context);
-    else if (dynamic_cast<NBinaryOp*>(this) != nullptr)
-        return dynamic_cast<NBinaryOp*>(this)->codeGen(context);
-    else if (dynamic_cast<NUnaryOp*>(this) != nullptr)
-        return dynamic_cast<NUnaryOp*>(this)->codeGen(context);
-    else
-        return NULL;
+    return VisitNode(*this, CodeGenVisitor(context));
 }
 
 Value* NStatement::codeGen(CodeGenContext& context)
 {
-    if (dynamic_cast<NAssignment*>(this) != nullptr)
-        return dynamic_cast<NAssignment*>(this)->codeGen(context);
-    else if (dynamic_cast<NExpressionStatement*>(this) != nullptr)
-        return dynamic_cast<NExpressionStatement*>(this)->codeGen(context);
-    else if (dynamic_cast<NVariableDecl*>(this) != nullptr)
-        return dynamic_cast<NVariableDecl*>(this)->codeGen(context);
-    else if (dynamic_cast<NVariableCompoundDecl*>(this) != nullptr)
-        return dynamic_cast<NVariableCompoundDecl*>(this)->codeGen(context);
-    else if (dynamic_cast<NFunctionDecl*>(this) != nullptr)
-        return dynamic_cast<NFunctionDecl*>(this)->codeGen(context);
-    else if (dynamic_cast<NIfStatement*>(this) != nullptr)
-        return dynamic_cast<NIfStatement*>(this)->codeGen(context);
-    else if (dynamic_cast<NForStatement*>(this) != nullptr)
-        return dynamic_cast<NForStatement*>(this)->codeGen(context);
-    else if (dynamic_cast<NWhileStatement*>(this) != nullptr)
-        return dynamic_cast<NWhileStatement*>(this)->codeGen(context);
-    else if (dynamic_cast<NPrintStatement*>(this) != nullptr)
-        return dynamic_cast<NPrintStatement*>(this)->codeGen(context);
-    else if (dynamic_cast<NReadStatement*>(this) != nullptr)
-        return dynamic_cast<NReadStatement*>(this)->codeGen(context);
-    else if (dynamic_cast<NReturnStatement*>(this) != nullptr)
-        return dynamic_cast<NReturnStatement*>(this)->codeGen(context);
-    else
-        return NULL;
+    return VisitNode(*this, CodeGenVisitor(context));
 }
 
 Value* NInteger::codeGen(CodeGenContext& context)
@@ -124,78 +713,40 @@ Value* NReal::codeGen(CodeGenContext& context)
 
 Value* NStringLiteral::codeGen(CodeGenContext& context)
 {
-    std::vector<Constant*> char_values;
-
-    ArrayType* arr_type = ArrayType::get(context.GetIntegerType(), this->value.length() + 1);
-
-    for (int i = 0; i < this->value.length(); i++)
-        char_values.push_back(Constant::getIntegerValue(context.GetIntegerType(), APInt(ADDRSPC, int(this->value[i]), true)));
-
-    return ConstantArray::get(arr_type, char_values);
+    return context.GetStringConstant(unquote(this->value));
 }
 
 Value* NIdentifier::codeGen(CodeGenContext& context)
 {
-    Value *var_ptr;
-
-    if (context.locals().find(this->name) == context.locals().end()) {
-        if (context.globals.find(this->name) == context.globals.end()) {
-            err_and_halt("undeclared variable " + this->name);
-        } else {
-            var_ptr = context.globals[this->name];
-        }
-    } else {
-        var_ptr = context.locals()[this->name];
-    }
+    Value *var_ptr = slotOf(*this, context);
 
-    return new LoadInst(var_ptr, "", false, context.currentBlock());
+    return new LoadInst(slotType(var_ptr), var_ptr, "", false, context.currentBlock());
 }
 
 Value* NVariable::codeGen(CodeGenContext& context)
 {
-    Value *var_ptr;
-
-    if (context.locals().find(this->identifier.name) == context.locals().end()) {
-        if (context.globals.find(this->identifier.name) == context.globals.end()) {
-            err_and_halt("undeclared variable " + this->identifier.name);
-        } else {
-            var_ptr = context.globals[this->identifier.name];
-        }
-    } else {
-        var_ptr = context.locals()[this->identifier.name];
-    }
-
-    switch (this->type) {
-        case VARIABLE_BASIC: return new LoadInst(var_ptr, "", false, context.currentBlock());
-        case VARIABLE_ARRAY:
-            Value* arr_index_val = this->arr_size.codeGen(context);
-            
-            if (arr_index_val->getType() != context.GetIntegerType())
-                err_and_halt("CodeGen<NVariable>: Non-integer array index (" + this->identifier.name + ")");
-            
-            
-            std::vector<Value*> index_vect;
-            index_vect.push_back(arr_index_val);
-            Value *gep = GetElementPtrInst::CreateInBounds(var_ptr, index_vect, "", context.currentBlock());
-            
-            return new LoadInst(gep, "", false, context.currentBlock());
-    }
+    Type *elem_type;
+    Value *var_ptr = addressOf(*this, context, elem_type);
 
-    err_and_halt("CodeGen<NVariable>: Undefined type attribute: " + std::to_string(this->type) + "(" + this->identifier.name + ")");
+    return new LoadInst(elem_type, var_ptr, "", false, context.currentBlock());
 }
 
 Value* NFunctionCall::codeGen(CodeGenContext& context)
 {
-    
+    Function *function = context.GetFunction(this->id.name);
+    if (function == NULL)
+        err_and_halt("CodeGen<NFunctionCall>: Call to undeclared function " + this->id.name.str());
+
+    if (this->arguments.size() != function->arg_size())
+        err_and_halt("CodeGen<NFunctionCall>: " + this->id.name.str() + " takes " + std::to_string(function->arg_size())
+            + " argument(s), called with " + std::to_string(this->arguments.size()));
 
-    Function *function = context.module->getFunction(this->id.name.c_str());
-    if (function == NULL) {
-        
-    }
     std::vector<Value*> args;
     ExpressionList::const_iterator it;
     for (it = arguments.begin(); it != arguments.end(); it++) {
-        args.push_back((**it).codeGen(context));
+        Value *arg = (**it).codeGen(context);
+
+        args.push_back(convertTo(arg, function->getFunctionType()->getParamType(args.size()), context));
     }
     CallInst *call = CallInst::Create(function, args, "", context.currentBlock());
     
@@ -204,44 +755,83 @@ Value* NFunctionCall::codeGen(CodeGenContext& context)
 
 Value* NBinaryOp::codeGen(CodeGenContext& context)
 {
-    Instruction::BinaryOps instr;
-    CmpInst::Predicate pred;
+    Instruction::BinaryOps instr, fp_instr;
+    CmpInst::Predicate pred, fp_pred;
+
+    Value *lhs_val = this->lhs->codeGen(context);
+    Value *rhs_val = this->rhs->codeGen(context);
+
+    /* An integer operand next to a real one is promoted; comparison results are widened next to integers */
+    bool real = lhs_val->getType()->isDoubleTy() || rhs_val->getType()->isDoubleTy();
+    Type *operand_type = real ? context.GetRealType() : context.GetIntegerType();
+
+    if (real || lhs_val->getType() != rhs_val->getType()) {
+        lhs_val = convertTo(lhs_val, operand_type, context);
+        rhs_val = convertTo(rhs_val, operand_type, context);
+    }
 
     switch (this->op) {
-        case TCEQ:      pred = CmpInst::Predicate::ICMP_EQ; goto logic;
-        case TCNE:      pred = CmpInst::Predicate::ICMP_NE; goto logic;
-        case TCLT:      pred = CmpInst::Predicate::ICMP_SLT; goto logic;
-        case TCLE:      pred = CmpInst::Predicate::ICMP_SLE; goto logic;
-        case TCGT:      pred = CmpInst::Predicate::ICMP_SGT; goto logic;
-        case TCGE:      pred = CmpInst::Predicate::ICMP_SGE; goto logic;
-        case TPLUS:     instr = Instruction::Add; goto math;
-        case TMINUS:    instr = Instruction::Sub; goto math;
-        case TMUL:      instr = Instruction::Mul; goto math;
-        case TDIV:      instr = Instruction::SDiv; goto math;
-        case TNUMDIV:   instr = Instruction::SDiv; goto math;
-        case TNUMMOD:   return BinaryOperator::CreateSRem(this->lhs.codeGen(context),
-                            this->rhs.codeGen(context), "", context.currentBlock());
-        case TLOGICAND: instr = Instruction::And; goto math;
-        case TLOGICOR:  instr = Instruction::Or; goto math;
+        case TCEQ:      pred = CmpInst::Predicate::ICMP_EQ; fp_pred = CmpInst::Predicate::FCMP_OEQ; goto logic;
+        case TCNE:      pred = CmpInst::Predicate::ICMP_NE; fp_pred = CmpInst::Predicate::FCMP_UNE; goto logic;
+        case TCLT:      pred = CmpInst::Predicate::ICMP_SLT; fp_pred = CmpInst::Predicate::FCMP_OLT; goto logic;
+        case TCLE:      pred = CmpInst::Predicate::ICMP_SLE; fp_pred = CmpInst::Predicate::FCMP_OLE; goto logic;
+        case TCGT:      pred = CmpInst::Predicate::ICMP_SGT; fp_pred = CmpInst::Predicate::FCMP_OGT; goto logic;
+        case TCGE:      pred = CmpInst::Predicate::ICMP_SGE; fp_pred = CmpInst::Predicate::FCMP_OGE; goto logic;
+        case TPLUS:     instr = Instruction::Add; fp_instr = Instruction::FAdd; goto math;
+        case TMINUS:    instr = Instruction::Sub; fp_instr = Instruction::FSub; goto math;
+        case TMUL:      instr = Instruction::Mul; fp_instr = Instruction::FMul; goto math;
+        case TDIV:      instr = Instruction::SDiv; fp_instr = Instruction::FDiv; goto math;
+        case TNUMDIV:   instr = Instruction::SDiv; fp_instr = Instruction::FDiv; goto math;
+        case TNUMMOD:   instr = Instruction::SRem; fp_instr = Instruction::FRem; goto math;
+        case TLOGICAND: instr = Instruction::And; goto bitwise;
+        case TLOGICOR:  instr = Instruction::Or; goto bitwise;
+        case OP_SHL:    instr = Instruction::Shl; goto bitwise;
+        case OP_ASHR:   instr = Instruction::AShr; goto bitwise;
+        case OP_LSHR:   instr = Instruction::LShr; goto bitwise;
+        case OP_BITAND: instr = Instruction::And; goto bitwise;
     }
 
     return NULL;
 math:
-    return BinaryOperator::Create(instr, this->lhs.codeGen(context), 
-        this->rhs.codeGen(context), "", context.currentBlock());
+    if (real) {
+        Value *result = fastMath(BinaryOperator::Create(fp_instr, lhs_val, rhs_val, "", context.currentBlock()), context);
+
+        /* div drops the fraction of reals too, mod is fmod's remainder */
+        if (this->op == TNUMDIV) {
+            Function *trunc = Intrinsic::getDeclaration(context.module, Intrinsic::trunc, context.GetRealType());
+            result = CallInst::Create(trunc, result, "", context.currentBlock());
+        }
+        return result;
+    }
+
+bitwise:
+    if (real)
+        err_and_halt("CodeGen<NBinaryOp>: Operator " + std::to_string(this->op) + " needs integer operands");
+
+    return BinaryOperator::Create(instr, lhs_val, rhs_val, "", context.currentBlock());
 
 logic:
-    return new ICmpInst(*context.currentBlock(), pred, this->lhs.codeGen(context),
-        this->rhs.codeGen(context), "");
+    if (real)
+        return fastMath(new FCmpInst(*context.currentBlock(), fp_pred, lhs_val, rhs_val, ""), context);
+
+    return new ICmpInst(*context.currentBlock(), pred, lhs_val, rhs_val, "");
 }
 
 Value* NUnaryOp::codeGen(CodeGenContext& context)
 {
+    Value *val = this->expr->codeGen(context);
+    bool real = val->getType()->isDoubleTy();
+
     switch (this->op) {
         case TMINUS:
-            return BinaryOperator::CreateNeg(this->expr.codeGen(context), "", context.currentBlock());
+            if (real)
+                return fastMath(UnaryOperator::CreateFNeg(val, "", context.currentBlock()), context);
+            return BinaryOperator::CreateNeg(val, "", context.currentBlock());
         case TLOGICNOT:
-            return BinaryOperator::CreateNot(this->expr.codeGen(context), "", context.currentBlock());
+            /* A real is true when it is not zero */
+            if (real)
+                return new FCmpInst(*context.currentBlock(), CmpInst::Predicate::FCMP_OEQ, val, ConstantFP::get(val->getType(), 0.0), "");
+            return BinaryOperator::CreateNot(val, "", context.currentBlock());
     }
 
     return NULL;
@@ -249,40 +839,15 @@ Value* NUnaryOp::codeGen(CodeGenContext& context)
 
 Value* NAssignment::codeGen(CodeGenContext& context)
 {
-    Value *var_ptr;
+    Type *elem_type;
+    Value *var_ptr = addressOf(this->lhs, context, elem_type);
 
-    if (context.locals().find(this->lhs.identifier.name) == context.locals().end()) {
-        if (context.globals.find(this->lhs.identifier.name) == context.globals.end()) {
-            err_and_halt("undeclared variable " + this->lhs.identifier.name);
-        } else {
-            var_ptr = context.globals[this->lhs.identifier.name];
-        }
-    } else {
-        var_ptr = context.locals()[this->lhs.identifier.name];
-    }
-
-    switch (this->lhs.type) {
-        case VARIABLE_BASIC: return new StoreInst(rhs.codeGen(context), var_ptr, false, context.currentBlock());
-        case VARIABLE_ARRAY:
-            
-            Value* arr_index_val = this->lhs.arr_size.codeGen(context);
-
-            if (arr_index_val->getType() != context.GetIntegerType())
-                err_and_halt("CodeGen<NAssignment><NVariable>: Non-integer array index (" + this->lhs.identifier.name + ")");
-            
-            std::vector<Value*> index_vect;
-            index_vect.push_back(arr_index_val);
-            Value *gep = GetElementPtrInst::CreateInBounds(var_ptr, index_vect, "", context.currentBlock());
-            
-            return new StoreInst(rhs.codeGen(context), gep, false, context.currentBlock());
-    }
-
-    err_and_halt("CodeGen<NAssignment><NVariable>: Undefined type attribute: " + std::to_string(this->lhs.type) + "(" + this->lhs.identifier.name + ")");
+    return new StoreInst(convertTo(this->rhs->codeGen(context), elem_type, context), var_ptr, false, context.currentBlock());
 }
 
 Value* NExpressionStatement::codeGen(CodeGenContext& context)
 {
-    return this->expression.codeGen(context);
+    return this->expression->codeGen(context);
 }
 
 Value* NVariableDecl::codeGen(CodeGenContext& context)
@@ -291,28 +856,31 @@ Value* NVariableDecl::codeGen(CodeGenContext& context)
     GlobalVariable *gvar;
 
     if (context.isSymtabEmpty()) {
-        
+        Type *var_type;
+
         if (this->type == VARIABLE_BASIC) {
-            gvar = new GlobalVariable(*context.module, typeOf(this->type_id, context), false, GlobalValue::InternalLinkage, nullptr, this->id.name);
+            var_type = typeOf(this->type_id, context);
         } else if (this->type == VARIABLE_ARRAY) {
-            Type *arr_type;
-
             if (this->arr_size == 0)
-                arr_type = PointerType::get(typeOf(this->type_id, context), ADDRSPC);
+                var_type = PointerType::get(typeOf(this->type_id, context), ADDRSPC);
             else
-                arr_type = ArrayType::get(typeOf(this->type_id, context), this->arr_size);
-
-            gvar = new GlobalVariable(*context.module, arr_type, false, GlobalValue::InternalLinkage, nullptr, this->id.name);
+                var_type = ArrayType::get(typeOf(this->type_id, context), this->arr_size);
         } else
-            err_and_halt("CodeGen<NVariableDecl>: Undefined type attribute: " + std::to_string(this->type) + "(" + this->type_id.name + ")");
+            err_and_halt("CodeGen<NVariableDecl>: Undefined type attribute: " + std::to_string(this->type) + "(" + this->type_id.name.str() + ")");
+
+        /* Only the first shard defines globals, the others refer to them */
+        GlobalValue::LinkageTypes linkage = context.isSharded() ? GlobalValue::ExternalLinkage : GlobalValue::InternalLinkage;
+        Constant *init = context.ownsGlobals() ? Constant::getNullValue(var_type) : NULL;
 
-        context.globals[this->id.name] = gvar;
+        gvar = new GlobalVariable(*context.module, var_type, false, linkage, init, this->id.name.str());
+
+        context.global_slots[this->id.binding.index] = gvar;
         return gvar;
     }
             
 
     if (this->type == VARIABLE_BASIC) {
-        alloc = new AllocaInst(typeOf(this->type_id, context), ADDRSPC, this->id.name, context.currentBlock());
+        alloc = entryAlloca(typeOf(this->type_id, context), this->id.name.str(), context);
         
     } else if (this->type == VARIABLE_ARRAY) {
         Type *arr_type;
@@ -322,13 +890,13 @@ Value* NVariableDecl::codeGen(CodeGenContext& context)
             else
                 arr_type = ArrayType::get(typeOf(this->type_id, context), this->arr_size);
                 
-        alloc = new AllocaInst(arr_type, ADDRSPC, this->id.name.c_str(), context.currentBlock());
+        alloc = entryAlloca(arr_type, this->id.name.str(), context);
         
     } else
-        err_and_halt("CodeGen<NVariableDecl>: Undefined type attribute: " + std::to_string(this->type) + "(" + this->type_id.name + ")");
+        err_and_halt("CodeGen<NVariableDecl>: Undefined type attribute: " + std::to_string(this->type) + "(" + this->type_id.name.str() + ")");
 
     
-    context.locals()[this->id.name] = alloc;
+    context.local_slots[this->id.binding.index] = alloc;
     return alloc;
 }
 
@@ -342,7 +910,18 @@ Value* NVariableCompoundDecl::codeGen(CodeGenContext& context)
     return NULL;
 }
 
-Value* NFunctionDecl::codeGen(CodeGenContext& context)
+/* A declaration inside another function's body, rather than one of the program's top-level functions */
+static bool isNested(NFunctionDecl& decl, CodeGenContext& context)
+{
+    if (context.curr_func == NULL)
+        return false;
+
+    std::unordered_map<Symbol, NFunctionDecl*>::iterator top = context.function_decls.find(decl.id.name);
+    return top == context.function_decls.end() || top->second != &decl;
+}
+
+/* Declares the function, so calls can be generated before (or without) its body */
+Function* NFunctionDecl::codeGenPrototype(CodeGenContext& context)
 {
     std::vector<Type*> argTypes;
     VariableList::const_iterator it;
@@ -350,26 +929,242 @@ Value* NFunctionDecl::codeGen(CodeGenContext& context)
         argTypes.push_back(typeOf((**it).type_id, context));
     }
     FunctionType *ftype = FunctionType::get(typeOf(this->type, context), argTypes, false);
-    Function *function = Function::Create(ftype, GlobalValue::InternalLinkage, this->id.name.c_str(), context.module);
-    BasicBlock *bblock = BasicBlock::Create(GlobCtx, INTRO_CTX, function, 0);
+
+    /* Shards call into each other until they are linked, see generateCodeSharded */
+    GlobalValue::LinkageTypes linkage = context.isSharded() ? GlobalValue::ExternalLinkage : GlobalValue::InternalLinkage;
+    std::string name = this->id.name.str();
+
+    /*
+     * Only the enclosing function can call a nested one, so it stays internal
+     * and is named after its parent: two shards or cache units never define
+     * the same symbol, and it cannot take a top-level function's name.
+     */
+    if (isNested(*this, context)) {
+        linkage = GlobalValue::InternalLinkage;
+        name = context.curr_func->getName().str() + "." + name;
+
+        std::unordered_map<Symbol, Function*>::iterator outer = context.functions.find(this->id.name);
+        context.shadowed_functions.push_back(std::make_pair(this->id.name, outer != context.functions.end() ? outer->second : NULL));
+    }
+
+    Function *function = Function::Create(ftype, linkage, name, context.module);
+    context.functions[this->id.name] = function;
+
+    return function;
+}
+
+/* call if expr is a call of decl itself with all of its arguments */
+static NFunctionCall *selfCall(NExpression& expr, NFunctionDecl& decl)
+{
+    if (expr.kind != NODE_FUNCTION_CALL)
+        return NULL;
+
+    NFunctionCall& call = static_cast<NFunctionCall&>(expr);
+    if (call.id.name != decl.id.name || call.arguments.size() != decl.arguments.size())
+        return NULL;
+
+    return &call;
+}
+
+/* Literals and the function's own scalars: can be evaluated early, or twice */
+static bool localOperand(NExpression& expr)
+{
+    switch (expr.kind) {
+        case NODE_INTEGER:
+        case NODE_REAL:
+            return true;
+        case NODE_VARIABLE:
+            return static_cast<NVariable&>(expr).type == VARIABLE_BASIC
+                && static_cast<NVariable&>(expr).identifier.binding.scope == BINDING_LOCAL;
+        case NODE_BINARY_OP:
+            return localOperand(*static_cast<NBinaryOp&>(expr).lhs) && localOperand(*static_cast<NBinaryOp&>(expr).rhs);
+        case NODE_UNARY_OP:
+            return localOperand(*static_cast<NUnaryOp&>(expr).expr);
+        default:
+            break;
+    }
+    return false;
+}
+
+/* For `return x + f(...)` and `return x * f(...)` (either order): the call, the operator and x */
+static NFunctionCall *accumulatedCall(NExpression& expr, NFunctionDecl& decl, int& op, NExpression *&operand)
+{
+    if (expr.kind != NODE_BINARY_OP)
+        return NULL;
+
+    NBinaryOp& bin = static_cast<NBinaryOp&>(expr);
+    if (bin.op != TPLUS && bin.op != TMUL)
+        return NULL;
+
+    NFunctionCall *call;
+    if ((call = selfCall(*bin.rhs, decl)) != NULL && localOperand(*bin.lhs))
+        operand = bin.lhs;
+    else if ((call = selfCall(*bin.lhs, decl)) != NULL && localOperand(*bin.rhs))
+        operand = bin.rhs;
+    else
+        return NULL;
+
+    op = bin.op;
+    return call;
+}
+
+/*
+ * Looks for self-calls in tail position in a function body (not in nested
+ * functions). Returns true if there are any; `op` is set to the operator of
+ * the first accumulator form found, 0 if there is none.
+ */
+static bool findTailRecursion(StatementList& stmts, NFunctionDecl& decl, int& op)
+{
+    bool found = false;
+
+    for (StatementList::iterator it = stmts.begin(); it != stmts.end(); it++) {
+        NStatement& stmt = **it;
+        int acc_op;
+        NExpression *operand;
+
+        switch (stmt.kind) {
+            case NODE_RETURN:
+                if (selfCall(*static_cast<NReturnStatement&>(stmt).expression, decl) != NULL)
+                    found = true;
+                else if (accumulatedCall(*static_cast<NReturnStatement&>(stmt).expression, decl, acc_op, operand) != NULL) {
+                    found = true;
+                    if (op == 0)
+                        op = acc_op;
+                }
+                break;
+            case NODE_IF:
+                found |= findTailRecursion(static_cast<NIfStatement&>(stmt).then_body, decl, op);
+                found |= findTailRecursion(static_cast<NIfStatement&>(stmt).else_body, decl, op);
+                break;
+            case NODE_FOR:
+                found |= findTailRecursion(static_cast<NForStatement&>(stmt).body, decl, op);
+                break;
+            case NODE_WHILE:
+                found |= findTailRecursion(static_cast<NWhileStatement&>(stmt).body, decl, op);
+                break;
+            default:
+                break;
+        }
+    }
+
+    return found;
+}
+
+/* A self tail call: the arguments become the new parameter values and control goes back to the top */
+static void genTailJump(NFunctionCall& call, CodeGenContext& context)
+{
+    NFunctionDecl& decl = *context.tailrec.decl;
+    FunctionType *ftype = context.curr_func->getFunctionType();
+    std::vector<Value*> args;
+
+    /* All arguments are evaluated before any parameter changes */
+    for (size_t i = 0; i < call.arguments.size(); i++)
+        args.push_back(convertTo(call.arguments[i]->codeGen(context), ftype->getParamType(i), context));
+
+    for (size_t i = 0; i < args.size(); i++)
+        new StoreInst(args[i], context.local_slots[decl.arguments[i]->id.binding.index], context.currentBlock());
+
+    BranchInst::Create(context.tailrec.loop, context.currentBlock());
+}
+
+/* Returns val, combined with what the earlier iterations accumulated */
+static void genReturn(Value *val, CodeGenContext& context)
+{
+    TailRecursion& tailrec = context.tailrec;
+    val = convertTo(val, context.curr_func->getReturnType(), context);
+
+    if (tailrec.accumulator != NULL) {
+        Value *acc = new LoadInst(tailrec.accumulator->getAllocatedType(), tailrec.accumulator, "", false, context.currentBlock());
+        val = BinaryOperator::Create(tailrec.op == TMUL ? Instruction::Mul : Instruction::Add, acc, val, "", context.currentBlock());
+    }
+
+    ReturnInst::Create(context.GetLLVMContext(), val, context.currentBlock());
+}
+
+Value* NFunctionDecl::codeGen(CodeGenContext& context)
+{
+    TraceScope trace(this->id.name.c_str(), TRACE_FUNCTION);
+
+    /* Top-level functions may already be declared by a call, nested ones are declared here */
+    Function *function = isNested(*this, context) ? NULL : context.GetFunction(this->id.name);
+    if (function == NULL || !function->empty())
+        function = this->codeGenPrototype(context);
+
+    FunctionType *ftype = function->getFunctionType();
+    VariableList::const_iterator it;
+    BasicBlock *bblock = BasicBlock::Create(context.GetLLVMContext(), INTRO_CTX, function, 0);
 
     context.pushBlock(bblock);
 
+    /* Nested declarations must not clobber the enclosing function's slots */
+    Function *outer_func = context.curr_func;
+    std::vector<Value*> outer_slots;
+    outer_slots.swap(context.local_slots);
+
+    TailRecursion outer_tailrec = context.tailrec;
+    context.tailrec = TailRecursion();
+
     context.curr_func = function;
-    context.symtab[function->getName()] = * new std::map<std::string, Value*>;
+    context.local_slots.assign(this->num_locals, NULL);
+    size_t outer_shadowed = context.shadowed_functions.size();
 
-    for (it = this->arguments.begin(); it != this->arguments.end(); it++) {
-        (**it).codeGen(context);
+    /* Arguments live in their own slots, so they can be assigned like any local */
+    Function::arg_iterator arg = function->arg_begin();
+    for (it = this->arguments.begin(); it != this->arguments.end(); it++, arg++) {
+        AllocaInst *slot = static_cast<AllocaInst*>((**it).codeGen(context));
+
+        /* Array parameters are declared with their element type and have nothing to store */
+        if ((**it).type == VARIABLE_BASIC)
+            new StoreInst(convertTo(&*arg, slot->getAllocatedType(), context), slot, context.currentBlock());
+    }
+
+    /*
+     * Self-recursion in tail position loops back to the top of the body
+     * instead of calling (see NReturnStatement). In an integer function,
+     * `return x * f(...)` and `return x + f(...)` loop too: x goes into an
+     * accumulator that every return then applies to its value.
+     */
+    int acc_op = 0;
+    bool array_params = false;
+    for (it = this->arguments.begin(); it != this->arguments.end(); it++)
+        array_params |= ((**it).type != VARIABLE_BASIC);
+
+    if (!array_params && findTailRecursion(this->body, *this, acc_op)) {
+        context.tailrec.decl = this;
+        context.tailrec.loop = BasicBlock::Create(context.GetLLVMContext(), "tailrecurse", function);
+
+        if (acc_op != 0 && ftype->getReturnType()->isIntegerTy()) {
+            context.tailrec.op = acc_op;
+            context.tailrec.accumulator = entryAlloca(ftype->getReturnType(), "acc", context);
+            new StoreInst(ConstantInt::get(ftype->getReturnType(), acc_op == TMUL ? 1 : 0), context.tailrec.accumulator, context.currentBlock());
+        }
+
+        BranchInst::Create(context.tailrec.loop, context.currentBlock());
+        context.popBlock();
+        context.pushBlock(context.tailrec.loop);
     }
     
-    StatementList::const_iterator sit;
-    for (sit = this->body.begin(); sit != this->body.end(); sit++) {
-        
-        (**sit).codeGen(context);
+    genStatements(this->body, context);
+
+    /* Falling off the end of a function returns zero */
+    if (context.currentBlock()->getTerminator() == NULL)
+        genReturn(Constant::getNullValue(ftype->getReturnType()), context);
+
+    /* The functions nested in this one go out of scope with it */
+    while (context.shadowed_functions.size() > outer_shadowed) {
+        std::pair<Symbol, Function*> shadowed = context.shadowed_functions.back();
+        context.shadowed_functions.pop_back();
+
+        if (shadowed.second == NULL)
+            context.functions.erase(shadowed.first);
+        else
+            context.functions[shadowed.first] = shadowed.second;
     }
 
     context.popBlock();
-    context.curr_func = NULL;
+    context.curr_func = outer_func;
+    context.local_slots.swap(outer_slots);
+    context.tailrec = outer_tailrec;
 
     
     return function;
@@ -377,33 +1172,26 @@ Value* NFunctionDecl::codeGen(CodeGenContext& context)
 
 Value* NIfStatement::codeGen(CodeGenContext& context)
 {
-    BasicBlock *then_block = BasicBlock::Create(GlobCtx, "then", context.currentBlock()->getParent());
-    BasicBlock *else_block = BasicBlock::Create(GlobCtx, "else", context.currentBlock()->getParent());
-    BasicBlock *fin_block = BasicBlock::Create(GlobCtx, "iffin", context.currentBlock()->getParent());
+    BasicBlock *then_block = BasicBlock::Create(context.GetLLVMContext(), "then", context.currentBlock()->getParent());
+    BasicBlock *else_block = BasicBlock::Create(context.GetLLVMContext(), "else", context.currentBlock()->getParent());
+    BasicBlock *fin_block = BasicBlock::Create(context.GetLLVMContext(), "iffin", context.currentBlock()->getParent());
 
-    BranchInst *ifbr = BranchInst::Create(then_block, else_block, this->condition.codeGen(context), context.currentBlock());
+    BranchInst *ifbr = BranchInst::Create(then_block, else_block, truthValue(this->condition->codeGen(context), context), context.currentBlock());
 
+    /* Nested statements may leave us in another block than the one pushed */
     context.pushBlock(then_block);
+    genStatements(this->then_body, context);
 
-    StatementList::const_iterator t_it;
-    for (t_it = this->then_body.begin(); t_it != this->then_body.end(); t_it++) {
-        
-        (**t_it).codeGen(context);
-    }
-
-    BranchInst::Create(fin_block, then_block);
+    if (context.currentBlock()->getTerminator() == NULL)
+        BranchInst::Create(fin_block, context.currentBlock());
 
     context.popBlock();
 
     context.pushBlock(else_block);
+    genStatements(this->else_body, context);
 
-    StatementList::const_iterator e_it;
-    for (e_it = this->else_body.begin(); e_it != this->else_body.end(); e_it++) {
-        
-        (**e_it).codeGen(context);
-    }
-
-    BranchInst::Create(fin_block, else_block);
+    if (context.currentBlock()->getTerminator() == NULL)
+        BranchInst::Create(fin_block, context.currentBlock());
 
     context.popBlock();
 
@@ -413,93 +1201,119 @@ Value* NIfStatement::codeGen(CodeGenContext& context)
     return fin_block;
 }
 
-Value* NForStatement::codeGen(CodeGenContext& context)
+/* i <= to when counting up, i >= to when counting down; the direction is only tested at run time when the step is not constant */
+static Value *loopTest(Value *iter_val, Value *to_val, Value *by_val, CodeGenContext& context)
 {
-    Value *var_ptr;
+    BasicBlock *block = context.currentBlock();
 
-    if (context.locals().find(this->iterator.identifier.name) == context.locals().end()) {
-        if (context.globals.find(this->iterator.identifier.name) == context.globals.end()) {
-            err_and_halt("undeclared variable " + this->iterator.identifier.name);
-        } else {
-            var_ptr = context.globals[this->iterator.identifier.name];
-        }
-    } else {
-        var_ptr = context.locals()[this->iterator.identifier.name];
-    }
+    if (iter_val->getType()->isDoubleTy()) {
+        Value *up = fastMath(new FCmpInst(*block, CmpInst::Predicate::FCMP_OLE, iter_val, to_val, ""), context);
+        Value *down = fastMath(new FCmpInst(*block, CmpInst::Predicate::FCMP_OGE, iter_val, to_val, ""), context);
 
-    var_ptr = new LoadInst(var_ptr, "", false, context.currentBlock());
+        if (ConstantFP *by_const = dyn_cast<ConstantFP>(by_val))
+            return by_const->isNegative() ? down : up;
 
-    
+        Value *is_down = new FCmpInst(*block, CmpInst::Predicate::FCMP_OLT, by_val, ConstantFP::get(by_val->getType(), 0.0), "");
+        return SelectInst::Create(is_down, down, up, "", block);
+    }
 
-    Value *iter_by_val = this->iter_by.codeGen(context);
+    if (ConstantInt *by_const = dyn_cast<ConstantInt>(by_val))
+        return new ICmpInst(*block, by_const->isNegative() ? CmpInst::Predicate::ICMP_SGE : CmpInst::Predicate::ICMP_SLE, iter_val, to_val, "");
 
-    if (iter_by_val == NULL)
-        iter_by_val = ConstantInt::get(context.GetIntegerType(), 0);
+    Value *up = new ICmpInst(*block, CmpInst::Predicate::ICMP_SLE, iter_val, to_val, "");
+    Value *down = new ICmpInst(*block, CmpInst::Predicate::ICMP_SGE, iter_val, to_val, "");
+    Value *is_down = new ICmpInst(*block, CmpInst::Predicate::ICMP_SLT, by_val, ConstantInt::get(by_val->getType(), 0), "");
+    return SelectInst::Create(is_down, down, up, "", block);
+}
 
-    
+/* Attaches the --vectorize-width / --unroll-count hints to a loop's back edge */
+static void addLoopHints(BranchInst *backedge, CodeGenContext& context)
+{
+    if (context.vectorize_width == 0 && context.unroll_count == 0)
+        return;
 
-    if (this->iterator.type == VARIABLE_BASIC) {
-        new StoreInst(iter_assign.codeGen(context), var_ptr, false, context.currentBlock());
-    } else if (this->iterator.type == VARIABLE_ARRAY) {
-        
-        Value* arr_index_val = this->iterator.arr_size.codeGen(context);
+    LLVMContext& ctx = context.GetLLVMContext();
+    Type *hint_type = Type::getInt32Ty(ctx);
+    std::vector<Metadata*> hints;
 
-        if (arr_index_val->getType() != context.GetIntegerType())
-            err_and_halt("CodeGen<NFor><NVariable>: Non-integer array index (" + this->iterator.identifier.name + ")");
-        
-        
-        std::vector<Value*> index_vect;
-        index_vect.push_back(arr_index_val);
-        Value *gep = GetElementPtrInst::CreateInBounds(var_ptr, index_vect, "", context.currentBlock());
-        
-        new StoreInst(iter_assign.codeGen(context), gep, false, context.currentBlock());
-    } else {
-        err_and_halt("CodeGen<NFor><NVariable>: Undefined type attribute: " + std::to_string(this->iterator.type) + "(" + this->iterator.identifier.name + ")");
+    /* The first operand of a loop ID is the loop ID itself */
+    hints.push_back(NULL);
+
+    if (context.vectorize_width > 1) {
+        Metadata *enable[] = { MDString::get(ctx, "llvm.loop.vectorize.enable"), ConstantAsMetadata::get(ConstantInt::getTrue(ctx)) };
+        hints.push_back(MDNode::get(ctx, enable));
+    }
+    if (context.vectorize_width > 0) {
+        Metadata *width[] = { MDString::get(ctx, "llvm.loop.vectorize.width"), ConstantAsMetadata::get(ConstantInt::get(hint_type, context.vectorize_width)) };
+        hints.push_back(MDNode::get(ctx, width));
+    }
+    if (context.unroll_count > 0) {
+        Metadata *count[] = { MDString::get(ctx, "llvm.loop.unroll.count"), ConstantAsMetadata::get(ConstantInt::get(hint_type, context.unroll_count)) };
+        hints.push_back(MDNode::get(ctx, count));
     }
 
-    
+    MDNode *loop_id = MDNode::getDistinct(ctx, hints);
+    loop_id->replaceOperandWith(0, loop_id);
+    backedge->setMetadata(LLVMContext::MD_loop, loop_id);
+}
 
-    BasicBlock *loop_block = BasicBlock::Create(GlobCtx, "loop", context.currentBlock()->getParent());
-    BasicBlock *loop_end = BasicBlock::Create(GlobCtx, "endloop", context.currentBlock()->getParent());
-    context.pushBlock(loop_block);
+/*
+ * for i := a to b by c as a counted loop LLVM can analyze: a, b and c are
+ * evaluated once before the loop, the header tests i against b before every
+ * iteration (so the body may not run at all) and the latch steps i. i stays
+ * a variable the body can read and assign; mem2reg makes it the induction
+ * variable. Without `by` the step is one.
+ */
+Value* NForStatement::codeGen(CodeGenContext& context)
+{
+    Function *func = context.currentBlock()->getParent();
 
-    StatementList::const_iterator it;
-    for (it = this->body.begin(); it != this->body.end(); it++) {
-        
-        (**it).codeGen(context);
-    }
+    Type *iter_type;
+    Value *iter_ptr = addressOf(this->iterator, context, iter_type);
+    bool real = iter_type->isDoubleTy();
 
-    
+    Value *from_val = convertTo(this->iter_assign->codeGen(context), iter_type, context);
+    Value *to_val = convertTo(this->iter_until->codeGen(context), iter_type, context);
+    Value *by_val = this->iter_by->codeGen(context);
 
-    if (this->iterator.type == VARIABLE_BASIC) {
-        var_ptr->print(outs(), true);
-        this->iter_until.codeGen(context)->print(outs(), true);
-        Value* updated_val = BinaryOperator::Create(Instruction::Add, var_ptr, iter_by_val, "", context.currentBlock());
-        new StoreInst(updated_val, var_ptr, false, context.currentBlock());
-        Value *loop_cond = new ICmpInst(*context.currentBlock(), CmpInst::Predicate::ICMP_SLE, var_ptr, this->iter_until.codeGen(context), "");
-        BranchInst::Create(loop_block, loop_end, loop_cond, loop_block);
-    } else if (this->iterator.type == VARIABLE_ARRAY) {
-        
-        Value* arr_index_val = this->iterator.arr_size.codeGen(context);
+    if (by_val == NULL)
+        by_val = real ? ConstantFP::get(iter_type, 1.0) : ConstantInt::get(iter_type, 1);
+    else
+        by_val = convertTo(by_val, iter_type, context);
 
-        if (arr_index_val->getType() != context.GetIntegerType())
-            err_and_halt("CodeGen<NFor><NVariable>: Non-integer array index (" + this->iterator.identifier.name + ")");
-        
-        
-        std::vector<Value*> index_vect;
-        index_vect.push_back(arr_index_val);
-        Value *gep = GetElementPtrInst::CreateInBounds(var_ptr, index_vect, "", context.currentBlock());
-        
+    new StoreInst(from_val, iter_ptr, false, context.currentBlock());
 
-        Value* updated_val = BinaryOperator::Create(Instruction::Add, gep, iter_by_val, "", context.currentBlock());
-        new StoreInst(updated_val, gep, false, context.currentBlock());
-        Value *loop_cond = new ICmpInst(*context.currentBlock(), CmpInst::Predicate::ICMP_SLE, gep, this->iter_until.codeGen(context), "");
-        BranchInst::Create(loop_block, loop_end, loop_cond, loop_block);
-    } else {
-        err_and_halt("CodeGen<NFor><NVariable>: Undefined type attribute: " + std::to_string(this->iterator.type) + "(" + this->iterator.identifier.name + ")");
-    }
+    BasicBlock *cond_block = BasicBlock::Create(context.GetLLVMContext(), "for.cond", func);
+    BasicBlock *body_block = BasicBlock::Create(context.GetLLVMContext(), "for.body", func);
+    BasicBlock *latch_block = BasicBlock::Create(context.GetLLVMContext(), "for.latch", func);
+    BasicBlock *loop_end = BasicBlock::Create(context.GetLLVMContext(), "for.end", func);
+
+    /* The block so far is the preheader */
+    BranchInst::Create(cond_block, context.currentBlock());
+
+    context.popBlock();
+    context.pushBlock(cond_block);
+
+    Value *iter_val = new LoadInst(iter_type, iter_ptr, "", false, context.currentBlock());
+    BranchInst::Create(body_block, loop_end, loopTest(iter_val, to_val, by_val, context), context.currentBlock());
 
     context.popBlock();
+    context.pushBlock(body_block);
+
+    genStatements(this->body, context);
+
+    if (context.currentBlock()->getTerminator() == NULL)
+        BranchInst::Create(latch_block, context.currentBlock());
+
+    context.popBlock();
+    context.pushBlock(latch_block);
+
+    iter_val = new LoadInst(iter_type, iter_ptr, "", false, context.currentBlock());
+    Value *next_val = real ? fastMath(BinaryOperator::Create(Instruction::FAdd, iter_val, by_val, "", context.currentBlock()), context)
+        : BinaryOperator::Create(Instruction::Add, iter_val, by_val, "", context.currentBlock());
+    new StoreInst(next_val, iter_ptr, false, context.currentBlock());
+
+    addLoopHints(BranchInst::Create(cond_block, context.currentBlock()), context);
 
     context.popBlock();
     context.pushBlock(loop_end);
@@ -509,22 +1323,24 @@ Value* NForStatement::codeGen(CodeGenContext& context)
 
 Value* NWhileStatement::codeGen(CodeGenContext& context)
 {
-    Value *while_cond = this->condition.codeGen(context);
+    BasicBlock *cond_block = BasicBlock::Create(context.GetLLVMContext(), "whlcond", context.currentBlock()->getParent());
+    BasicBlock *while_block = BasicBlock::Create(context.GetLLVMContext(), "whl", context.currentBlock()->getParent());
+    BasicBlock *while_end = BasicBlock::Create(context.GetLLVMContext(), "endwhl", context.currentBlock()->getParent());
 
-    BasicBlock *while_block = BasicBlock::Create(GlobCtx, "whl", context.currentBlock()->getParent());
-    BasicBlock *while_end = BasicBlock::Create(GlobCtx, "endwhl", context.currentBlock()->getParent());
+    BranchInst::Create(cond_block, context.currentBlock());
 
+    /* The condition is re-evaluated on every iteration */
+    context.popBlock();
+    context.pushBlock(cond_block);
+
+    Value *while_cond = truthValue(this->condition->codeGen(context), context);
     BranchInst::Create(while_block, while_end, while_cond, context.currentBlock());
 
     context.pushBlock(while_block);
+    genStatements(this->body, context);
 
-    StatementList::const_iterator it;
-    for (it = this->body.begin(); it != this->body.end(); it++) {
-        
-        (**it).codeGen(context);
-    }
-
-    BranchInst::Create(while_block, while_end, while_cond, context.currentBlock());
+    if (context.currentBlock()->getTerminator() == NULL)
+        BranchInst::Create(cond_block, context.currentBlock());
 
     context.popBlock();
 
@@ -534,57 +1350,106 @@ Value* NWhileStatement::codeGen(CodeGenContext& context)
     return NULL;
 }
 
+/* One printf per statement: literals are folded into the format, everything else becomes a conversion */
 Value* NPrintStatement::codeGen(CodeGenContext& context)
 {
     Function *printf = context.module->getFunction("printf");
 
-    ExpressionList::const_iterator it;
+    std::string format_string;
+    std::vector<Value*> args(1, NULL);
 
+    ExpressionList::const_iterator it;
     for (it = this->arguments.begin(); it != this->arguments.end(); it++) {
-        Value *put_val = (**it).codeGen(context);
+        if ((**it).kind == NODE_STRING_LITERAL) {
+            std::string text = unquote(static_cast<NStringLiteral&>(**it).value);
 
-        std::string format_string = "%s\n";
+            for (size_t i = 0; i < text.length(); i++)
+                format_string += (text[i] == '%') ? "%%" : std::string(1, text[i]);
 
-        if (put_val->getType()->isIntegerTy())
-            format_string = "%d\n";
-        else if (put_val->getType()->isDoubleTy())
-            format_string = "%lf\n";
+            continue;
+        }
 
-        Constant *format_const = ConstantDataArray::getString(GlobCtx, format_string);
-        GlobalVariable *var = new GlobalVariable(
-            *context.module, ArrayType::get(context.GetIntegerType(), 4),
-            true, GlobalValue::PrivateLinkage, format_const, ".str");
-        
-        Constant *zero = Constant::getNullValue(context.GetIntegerType());
+        Value *put_val = (**it).codeGen(context);
 
-        std::vector<Value*> indices;
-        indices.push_back(zero);
-        indices.push_back(zero);
-        Value *var_ref = GetElementPtrInst::CreateInBounds(var, indices, "", context.currentBlock());
+        if (put_val->getType()->isDoubleTy()) {
+            format_string += "%lf";
+        } else {
+            format_string += "%lld";
+            put_val = convertTo(put_val, context.GetIntegerType(), context);
+        }
 
-        std::vector<Value*> args;
-        args.push_back(var_ref);
         args.push_back(put_val);
-
-        CallInst::Create(printf, args, "", context.currentBlock());
     }
 
-    return NULL;
+    if (format_string.empty())
+        return NULL;
+
+    args[0] = context.GetStringConstant(format_string);
+
+    return CallInst::Create(printf, args, "", context.currentBlock());
 }
 
+/* Each destination, scalar or array element, is filled by one call into the runtime */
 Value* NReadStatement::codeGen(CodeGenContext& context)
 {
+    Function *read_int = context.module->getFunction(READ_INT_FUNC);
+    Function *read_real = context.module->getFunction(READ_REAL_FUNC);
+
+    ExpressionList::const_iterator it;
+    for (it = this->destinations.begin(); it != this->destinations.end(); it++) {
+        if ((**it).kind != NODE_VARIABLE)
+            err_and_halt("CodeGen<NReadStatement>: Can only read into variables");
+
+        Type *elem_type;
+        Value *var_ptr = addressOf(static_cast<NVariable&>(**it), context, elem_type);
+
+        Function *reader = elem_type->isDoubleTy() ? read_real : read_int;
+        Value *read_val = CallInst::Create(reader, "", context.currentBlock());
+
+        new StoreInst(convertTo(read_val, elem_type, context), var_ptr, false, context.currentBlock());
+    }
+
     return NULL;
 }
 
 Value* NReturnStatement::codeGen(CodeGenContext& context)
 {
-    return ReturnInst::Create(GlobCtx, this->expression.codeGen(context), context.currentBlock());
+    TailRecursion& tailrec = context.tailrec;
+    NFunctionCall *call;
+    NExpression *operand;
+    int op;
+
+    if (tailrec.loop != NULL && (call = selfCall(*this->expression, *tailrec.decl)) != NULL) {
+        genTailJump(*call, context);
+        return NULL;
+    }
+
+    if (tailrec.accumulator != NULL && (call = accumulatedCall(*this->expression, *tailrec.decl, op, operand)) != NULL && op == tailrec.op) {
+        Value *operand_val = operand->codeGen(context);
+
+        /* A real x would change the arithmetic; it has no side effects, so the plain return can evaluate it again */
+        if (operand_val->getType() == tailrec.accumulator->getAllocatedType()) {
+            Value *acc = new LoadInst(operand_val->getType(), tailrec.accumulator, "", false, context.currentBlock());
+            Instruction::BinaryOps instr = (op == TMUL) ? Instruction::Mul : Instruction::Add;
+            new StoreInst(BinaryOperator::Create(instr, acc, operand_val, "", context.currentBlock()), tailrec.accumulator, context.currentBlock());
+
+            genTailJump(*call, context);
+            return NULL;
+        }
+    }
+
+    genReturn(this->expression->codeGen(context), context);
+    return NULL;
 }
 
 Value* NProgram::codeGen(CodeGenContext& context)
 {
-    Function *printf = printf_prototype(GlobCtx, context.module);
+    TraceScope trace("codegen");
+
+    printf_prototype(context.GetLLVMContext(), context.module);
+    runtime_prototypes(context);
+
+    context.global_slots.assign(this->num_globals, NULL);
 
     StatementList::const_iterator vit;
     for (vit = this->variable_decl_stmts.begin(); vit != this->variable_decl_stmts.end(); vit++) {
@@ -592,23 +1457,42 @@ Value* NProgram::codeGen(CodeGenContext& context)
         (**vit).codeGen(context);
     }
 
+    /* Prototypes are emitted on first use, so a module that holds one function only declares what it calls */
     StatementList::const_iterator fit;
     for (fit = this->function_decl_stmts.begin(); fit != this->function_decl_stmts.end(); fit++) {
-        
-        (**fit).codeGen(context);
+        if ((**fit).kind == NODE_FUNCTION_DECL)
+            context.function_decls[static_cast<NFunctionDecl&>(**fit).id.name] = static_cast<NFunctionDecl*>(*fit);
+    }
+
+    size_t index = 0;
+    for (fit = this->function_decl_stmts.begin(); fit != this->function_decl_stmts.end(); fit++, index++) {
+        if (context.ownsFunction(index))
+            (**fit).codeGen(context);
     }
 
+    /* The entry point goes with the globals, into the first shard */
+    if (!context.ownsGlobals())
+        return NULL;
+
     FunctionType *ftype = FunctionType::get(context.GetIntegerType(), false);
-    Function *start_func = Function::Create(ftype, GlobalValue::InternalLinkage, "_start", context.module);
-    BasicBlock *entry_block = BasicBlock::Create(GlobCtx, "entry", start_func, 0);
+    /* The only externally visible symbol, so the optimizer keeps what it reaches */
+    Function *start_func = Function::Create(ftype, GlobalValue::ExternalLinkage, START_FUNC, context.module);
+    BasicBlock *entry_block = BasicBlock::Create(context.GetLLVMContext(), "entry", start_func, 0);
     
     context.pushBlock(entry_block);
     
-    if (context.module->getFunction("main") == NULL)
+    Function *main_func = context.GetFunction(Symbol::Intern(ROOT_FUNC));
+    if (main_func == NULL)
         err_and_halt("CodeGen<NProgram> There is no entry function 'main' exists!");
 
-    CallInst::Create(context.module->getFunction("main"), "", context.currentBlock());
-    ReturnInst::Create(GlobCtx, ConstantInt::get(context.GetIntegerType(), 0), context.currentBlock());
+    /* main's parameters, if it declares any, start out zeroed */
+    std::vector<Value*> main_args;
+    for (Function::arg_iterator ait = main_func->arg_begin(); ait != main_func->arg_end(); ait++)
+        main_args.push_back(Constant::getNullValue(ait->getType()));
+
+    /* main's return value becomes the exit status */
+    Value *ret_val = CallInst::Create(main_func, main_args, "", context.currentBlock());
+    ReturnInst::Create(context.GetLLVMContext(), convertTo(ret_val, context.GetIntegerType(), context), context.currentBlock());
     
     context.popBlock();
 
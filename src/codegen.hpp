@@ -4,6 +4,7 @@
 #include <stdio.h>
 
 #include <stack>
+#include <unordered_map>
 #include <llvm/Pass.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Function.h>
@@ -12,56 +13,131 @@
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/PassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/IR/PassTimingInfo.h>
+#include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/CallingConv.h>
 #include <llvm/ADT/StringRef.h>
 #include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Transforms/IPO/Internalize.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/Mangling.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SmallVectorMemoryBuffer.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
 
 #include "node.hpp"
 
 #define MODULE_NAME "main"
 #define ROOT_FUNC   "main"
 #define INTRO_CTX   "entry"
+#define START_FUNC  "_start"
+#define HOST_MAIN   "main"
+#define VLANG_MAIN  "vlang.main"
 
 #define INTEGER_ID  "int"
 #define FLOAT_ID    "real"
 
-using namespace llvm;
+#define MAX_OPT_LEVEL   3
 
-static LLVMContext GlobCtx;
+using namespace llvm;
 
 class CodeGenBlock {
 public:
     BasicBlock *block;
-    std::map<std::string, Value*> locals;
+};
+
+/* Tail recursion of the function being generated, see NFunctionDecl::codeGen */
+struct TailRecursion {
+    NFunctionDecl *decl;
+    BasicBlock *loop;           /* top of the body, where a self tail call jumps */
+    AllocaInst *accumulator;    /* NULL unless x + f(...) or x * f(...) are returned */
+    int op;
+
+    TailRecursion() : decl(NULL), loop(NULL), accumulator(NULL), op(0) { }
 };
 
 class CodeGenContext {
     std::stack<CodeGenBlock *> blocks;
     Function *mainFunction;
     Type *integer_type, *real_type;
+    TargetMachine *target_machine;
+    int target_opt_level;
+    bool target_host_cpu;
+    LLVMContext *llvm_context;     /* owned, one per compilation */
+    StringMap<GlobalVariable*> string_constants;
 
 public:
     Module *module;
     IRBuilder<> *curr_builder;
-    std::map<std::string, Value*> globals;
     Function *curr_func;
-    std::map<std::string, std::map<std::string, Value*>> symtab;
+    std::vector<Value*> global_slots;   /* indexed by Binding::index, see resolve.hpp */
+    std::vector<Value*> local_slots;
+    std::unordered_map<Symbol, Function*> functions;
+    std::unordered_map<Symbol, NFunctionDecl*> function_decls;  /* top-level, declared on first use */
+    std::vector<std::pair<Symbol, Function*> > shadowed_functions;  /* hidden by a nested function until its enclosing one ends */
+    /* Set when the program is split over several modules, see generateCodeSharded */
+    bool sharded;
+    bool owns_globals;                  /* globals and _start */
+    std::vector<bool> owned_functions;  /* top-level functions by position, empty for all */
+    bool fast_math;                     /* set before SetupTargetMachine, see fastMath() in codegen.cpp */
+    unsigned vectorize_width;           /* llvm.loop hints on for loops, 0 for none */
+    unsigned unroll_count;
+    TailRecursion tailrec;
+    unsigned cache_hits, cache_misses;
+    unsigned simplify_rewrites;         /* see SimplifyProgram */
 
     CodeGenContext() {
-        this->module = new Module(MODULE_NAME, GlobCtx);
-        this->integer_type = Type::getInt64Ty(GlobCtx);
-        this->real_type = Type::getDoubleTy(GlobCtx);
+        this->llvm_context = new LLVMContext();
+        this->module = new Module(MODULE_NAME, *this->llvm_context);
+        this->integer_type = Type::getInt64Ty(*this->llvm_context);
+        this->real_type = Type::getDoubleTy(*this->llvm_context);
         this->curr_func = NULL;
+        this->target_machine = NULL;
+        this->sharded = false;
+        this->owns_globals = true;
+        this->fast_math = false;
+        this->vectorize_width = this->unroll_count = 0;
+        this->cache_hits = this->cache_misses = 0;
+        this->simplify_rewrites = 0;
+    }
+
+    ~CodeGenContext() {
+        delete this->module;
+        delete this->llvm_context;
+        delete this->target_machine;
     }
     
     void generateCode(NProgram& root);
-    void runCode();
-    std::map<std::string, Value*>& locals() { return this->symtab[this->curr_func->getName()]; /*return blocks.top()->locals;*/ }
+    void generateCodeSharded(NProgram& root, unsigned shards, int opt_level, bool time_passes);
+    void generateCodeCached(NProgram& root, std::string cache_dir, unsigned threads, int opt_level, bool time_passes, std::string options_key);
+    bool isSharded() { return this->sharded; }
+    bool ownsFunction(size_t index) { return this->owned_functions.empty() || this->owned_functions[index]; }
+    bool ownsGlobals() { return this->owns_globals; }
+    Function *GetFunction(Symbol name);
+    void OptimizeModule(int level, bool time_passes);
+    void SetupTargetMachine(int opt_level, bool host_cpu);
+    void AddHostEntryPoint();
+    void AddProfileCounters(std::string profile_path);
+    void ApplyProfile(std::string profile_path);
+    void EmitObjectFile(std::string filename);
+    int runCode(bool print_times);
+    void DumpIR() { this->module->print(outs(), nullptr); }
     BasicBlock *currentBlock() { return blocks.top()->block; }
     bool isSymtabEmpty() { return this->blocks.empty(); }
     void pushBlock(BasicBlock *block) { blocks.push(new CodeGenBlock()); blocks.top()->block = block; }
@@ -69,7 +145,11 @@ public:
     IRBuilder<>* GetCurrentBuilder() { return this->curr_builder; }
     Type *GetIntegerType() { return this->integer_type; }
     Type *GetRealType() { return this->real_type; }
+    LLVMContext& GetLLVMContext() { return *this->llvm_context; }
+    Constant *GetStringConstant(StringRef text);
     void SaveIRToFile(std::string filename);
+    void SaveBitcodeToFile(std::string filename);
+    std::unique_ptr<MemoryBuffer> GetBitcodeBuffer();
 };
 
 #endif
\ No newline at end of file
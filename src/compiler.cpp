@@ -1,19 +1,392 @@
 #include <iostream>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/Path.h>
 #include "codegen.hpp"
 #include "node.hpp"
+#include "parse.hpp"
+#include "cache.hpp"
+#include "trace.hpp"
+#include "stats.hpp"
+#include "source.hpp"
 
 using namespace std;
 
-extern int yyparse();
-extern NProgram* programBlock;
+#define EMIT_IR     0
+#define EMIT_OBJ    1
+#define EMIT_EXE    2
+#define EMIT_RUN    3
+#define EMIT_BC     4
 
-int main()
+#define STDIN_OUTPUT    "out"
+#define SOURCE_EXT      ".v"
+#define LINKER          "cc"
+#define RUNTIME_OBJ     "vlrt.o"
+#define PROFILE_EXT     ".vlprof"
+
+#define PROFILE_NONE        0
+#define PROFILE_GENERATE    1
+#define PROFILE_USE         2
+
+struct CompileOptions {
+    int opt_level;
+    int emit;
+    bool host_cpu;
+    bool time_passes;
+    bool fast_math;
+    bool stats;
+    unsigned vectorize_width;
+    unsigned unroll_count;
+    unsigned function_shards;
+    string cache_dir;       /* empty: no incremental cache */
+    unsigned cache_threads; /* workers for the cache misses of one file */
+    int profile;
+    string profile_path;    /* empty: next to the source, see output_path */
+    string output;          /* -o, for a single source; "-" is stdout */
+    string output_dir;      /* empty: next to the source */
+    string runtime;
+};
+
+static void usage(const char *prog)
 {
-    yyparse();
+    cerr << "Usage: " << prog << " [-O0|-O1|-O2|-O3] [--emit=ir|bc|obj|exe|run] [--host-cpu] [--fast-math] [--vectorize-width=N] [--unroll-count=N] [--time-passes] [--parallel-codegen[=N]] [--cache[=DIR]] [--profile-generate[=FILE]] [--profile-use[=FILE]] [--trace[=FILE]] [--stats] [-j N] [-o FILE|--output-dir=DIR] [source.v ...]" << endl;
+    cerr << "Reads the program from stdin when no source file is given." << endl;
+}
+
+/* The runtime object is installed next to the compiler binary */
+static string runtime_object(const char *argv0)
+{
+    SmallString<256> path(sys::fs::getMainExecutable(argv0, (void *) &runtime_object));
+    sys::path::remove_filename(path);
+    sys::path::append(path, RUNTIME_OBJ);
+
+    return path.str().str();
+}
+
+/* foo.v gives foo.ll, foo.bc, foo.o and foo; stdin gives out.ll and so on */
+static string output_path(const string& input, const char *ext, const string& dir = "")
+{
+    SmallString<256> path(input.empty() ? STDIN_OUTPUT : input);
+    if (sys::path::extension(path) == SOURCE_EXT)
+        sys::path::replace_extension(path, "");
+
+    if (!dir.empty()) {
+        SmallString<256> name(sys::path::filename(path));
+        path = dir;
+        sys::path::append(path, name);
+    }
+
+    return path.str().str() + ext;
+}
+
+/* What --emit produces for a source, -o overriding the name; an executable's object goes next to it */
+static string artifact_path(const string& input, const char *ext, const CompileOptions& options)
+{
+    if (options.output.empty())
+        return output_path(input, ext, options.output_dir);
+
+    return options.output + (options.emit == EMIT_EXE && strcmp(ext, ".o") == 0 ? ".o" : "");
+}
+
+/* Links an object file and the runtime into an executable with the system C compiler driver */
+static int link_executable(const string& object, const string& runtime, const string& output)
+{
+    TraceScope trace("link", TRACE_PHASE, output.c_str());
+
+    ErrorOr<string> linker = sys::findProgramByName(LINKER);
+    if (!linker) {
+        cerr << "[ERROR] Linker: Cannot find " << LINKER << " in PATH" << endl;
+        return 1;
+    }
+
+    if (!sys::fs::exists(runtime)) {
+        cerr << "[ERROR] Linker: Runtime " << runtime << " not found, run make" << endl;
+        return 1;
+    }
+
+    string error;
+    StringRef args[] = { *linker, object, runtime, "-o", output };
+    int status = sys::ExecuteAndWait(*linker, args, None, {}, 0, 0, &error);
+
+    if (status != 0) {
+        cerr << "[ERROR] Linker: " << (error.empty() ? LINKER " failed" : error) << endl;
+        return 1;
+    }
 
-    CodeGenContext *context = new CodeGenContext();
-    context->generateCode(*programBlock);
-    context->SaveIRToFile("out.ll");
-    
     return 0;
-}
\ No newline at end of file
+}
+
+/* Compiles one source file (stdin when input is empty) on its own parser, context and module */
+static int compile_file(const string& input, const CompileOptions& options)
+{
+    TraceScope trace("compile", TRACE_PHASE, input.empty() ? "<stdin>" : input.c_str());
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    NProgram *program;
+
+    if (input.empty()) {
+        program = ParseProgram(stdin, "<stdin>");
+    } else {
+        /* Scanned straight from the mapping, released as soon as the tree is built */
+        SourceFile source;
+        if (!source.Open(input.c_str())) {
+            cerr << "[ERROR] Cannot open " << input << ": " << strerror(errno) << endl;
+            return 1;
+        }
+
+        program = ParseBuffer(source.ScanBuffer(), source.ScanSize(), input.c_str());
+    }
+
+    if (program == NULL)
+        return 1;
+
+    CodeGenContext *context = new CodeGenContext();
+    context->fast_math = options.fast_math;
+    context->vectorize_width = options.vectorize_width;
+    context->unroll_count = options.unroll_count;
+
+    /* The optimizer needs the target before it runs to use its cost models; the JIT always targets the host */
+    if ((options.emit != EMIT_IR && options.emit != EMIT_BC) || options.host_cpu)
+        context->SetupTargetMachine(options.opt_level, options.host_cpu || options.emit == EMIT_RUN);
+
+    if (!options.cache_dir.empty()) {
+        /* Everything that changes the generated code has to be part of the key */
+        string options_key = options.host_cpu ? "host" : "generic";
+        context->generateCodeCached(*program, options.cache_dir, options.cache_threads, options.opt_level, options.time_passes, options_key);
+
+        if (options.emit == EMIT_EXE)
+            context->AddHostEntryPoint();
+    } else if (options.function_shards > 1) {
+        /* Shards are optimized on their own threads before they are linked */
+        context->generateCodeSharded(*program, options.function_shards, options.opt_level, options.time_passes);
+
+        if (options.emit == EMIT_EXE)
+            context->AddHostEntryPoint();
+    } else {
+        context->generateCode(*program);
+
+        /* Both sides work on the unoptimized module so the CFG hashes of a function agree */
+        if (options.profile != PROFILE_NONE) {
+            SmallString<256> profile(options.profile_path.empty() ? output_path(input, PROFILE_EXT) : options.profile_path);
+
+            if (options.profile == PROFILE_GENERATE) {
+                /* The instrumented program may run from anywhere */
+                sys::fs::make_absolute(profile);
+                context->AddProfileCounters(profile.str().str());
+            } else {
+                context->ApplyProfile(profile.str().str());
+            }
+        }
+
+        if (options.emit == EMIT_EXE)
+            context->AddHostEntryPoint();
+
+        context->OptimizeModule(options.opt_level, options.time_passes);
+    }
+
+    /* The JIT takes the module away, so it is measured before anything is emitted */
+    if (options.stats)
+        cerr << ProgramStats(input.empty() ? "<stdin>" : input, *program, *context);
+
+    int status = 0;
+
+    if (options.emit == EMIT_RUN) {
+        std::chrono::duration<double, std::milli> codegen_time = std::chrono::steady_clock::now() - start;
+        std::cerr << "[TIME] codegen: " << codegen_time.count() << " ms" << std::endl;
+
+        /* The exit status is whatever the program's main returned */
+        status = context->runCode(true);
+    } else if (options.emit == EMIT_IR) {
+        context->SaveIRToFile(artifact_path(input, ".ll", options));
+    } else if (options.emit == EMIT_BC) {
+        context->SaveBitcodeToFile(artifact_path(input, ".bc", options));
+    } else {
+        context->EmitObjectFile(artifact_path(input, ".o", options));
+    }
+
+    if (options.emit == EMIT_EXE)
+        status = link_executable(artifact_path(input, ".o", options), options.runtime, artifact_path(input, "", options));
+
+    delete context;
+    delete program;
+
+    return status;
+}
+
+/* Files are independent: each worker takes the next one until none are left */
+static int compile_files(const vector<string>& inputs, const CompileOptions& options, unsigned jobs)
+{
+    if (jobs == 0 || jobs > inputs.size())
+        jobs = inputs.size();
+
+    std::atomic<size_t> next_input(0);
+    std::atomic<int> failures(0);
+    vector<std::thread> workers;
+
+    for (unsigned w = 0; w < jobs; w++) {
+        workers.push_back(std::thread([&]() {
+            for (size_t i = next_input++; i < inputs.size(); i = next_input++) {
+                if (compile_file(inputs[i], options) != 0)
+                    failures++;
+            }
+        }));
+    }
+
+    for (size_t w = 0; w < workers.size(); w++)
+        workers[w].join();
+
+    return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    CompileOptions options;
+    options.opt_level = 0;
+    options.emit = EMIT_IR;
+    options.host_cpu = false;
+    options.time_passes = false;
+    options.fast_math = false;
+    options.stats = false;
+    options.vectorize_width = options.unroll_count = 0;
+    options.function_shards = options.cache_threads = 1;
+    options.profile = PROFILE_NONE;
+    options.runtime = runtime_object(argv[0]);
+
+    unsigned jobs = std::thread::hardware_concurrency();
+    bool parallel_codegen = false;
+    unsigned shards = 0;    /* 0: what the file workers leave of -j */
+    string trace_file;      /* empty: no trace */
+    vector<string> inputs;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-O", 2) == 0 && strlen(argv[i]) == 3
+                && argv[i][2] >= '0' && argv[i][2] <= '0' + MAX_OPT_LEVEL) {
+            options.opt_level = argv[i][2] - '0';
+        } else if (strcmp(argv[i], "--emit=ir") == 0) {
+            options.emit = EMIT_IR;
+        } else if (strcmp(argv[i], "--emit=bc") == 0) {
+            options.emit = EMIT_BC;
+        } else if (strcmp(argv[i], "--emit=obj") == 0) {
+            options.emit = EMIT_OBJ;
+        } else if (strcmp(argv[i], "--emit=exe") == 0) {
+            options.emit = EMIT_EXE;
+        } else if (strcmp(argv[i], "--emit=run") == 0 || strcmp(argv[i], "--run") == 0) {
+            options.emit = EMIT_RUN;
+        } else if (strcmp(argv[i], "--host-cpu") == 0) {
+            options.host_cpu = true;
+        } else if (strcmp(argv[i], "--fast-math") == 0) {
+            options.fast_math = true;
+        } else if (strncmp(argv[i], "--vectorize-width=", 18) == 0 && atoi(argv[i] + 18) > 0) {
+            options.vectorize_width = atoi(argv[i] + 18);
+        } else if (strncmp(argv[i], "--unroll-count=", 15) == 0 && atoi(argv[i] + 15) > 0) {
+            options.unroll_count = atoi(argv[i] + 15);
+        } else if (strcmp(argv[i], "--time-passes") == 0) {
+            options.time_passes = true;
+        } else if (strcmp(argv[i], "--parallel-codegen") == 0) {
+            parallel_codegen = true;
+        } else if (strncmp(argv[i], "--parallel-codegen=", 19) == 0 && atoi(argv[i] + 19) > 0) {
+            parallel_codegen = true;
+            shards = atoi(argv[i] + 19);
+        } else if (strcmp(argv[i], "--cache") == 0) {
+            options.cache_dir = CACHE_DIR;
+        } else if (strncmp(argv[i], "--cache=", 8) == 0 && argv[i][8] != '\0') {
+            options.cache_dir = argv[i] + 8;
+        } else if (strcmp(argv[i], "--profile-generate") == 0 || strcmp(argv[i], "--profile-use") == 0) {
+            options.profile = argv[i][10] == 'g' ? PROFILE_GENERATE : PROFILE_USE;
+        } else if (strncmp(argv[i], "--profile-generate=", 19) == 0 && argv[i][19] != '\0') {
+            options.profile = PROFILE_GENERATE;
+            options.profile_path = argv[i] + 19;
+        } else if (strncmp(argv[i], "--profile-use=", 14) == 0 && argv[i][14] != '\0') {
+            options.profile = PROFILE_USE;
+            options.profile_path = argv[i] + 14;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            trace_file = TRACE_FILE;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0 && argv[i][8] != '\0') {
+            trace_file = argv[i] + 8;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            options.stats = true;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc && argv[i + 1][0] != '\0') {
+            options.output = argv[++i];
+        } else if (strncmp(argv[i], "--output-dir=", 13) == 0 && argv[i][13] != '\0') {
+            options.output_dir = argv[i] + 13;
+        } else if (argv[i][0] != '-') {
+            inputs.push_back(argv[i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    /* Counters and profile data are added to one whole, unoptimized module */
+    if (options.profile != PROFILE_NONE && (parallel_codegen || !options.cache_dir.empty())) {
+        cerr << "[WARN] --cache and --parallel-codegen are ignored with profiles" << endl;
+        parallel_codegen = false;
+        options.cache_dir.clear();
+    }
+
+    if (!options.profile_path.empty() && inputs.size() > 1) {
+        cerr << "[ERROR] A profile file can only be given for a single source file" << endl;
+        return 1;
+    }
+
+    if (!options.output.empty() && (inputs.size() > 1 || !options.output_dir.empty())) {
+        cerr << "[ERROR] -o takes a single source file, use --output-dir for several" << endl;
+        return 1;
+    }
+
+    if (options.output == "-" && options.emit == EMIT_EXE) {
+        cerr << "[ERROR] An executable cannot be written to stdout" << endl;
+        return 1;
+    }
+
+    if (!options.output_dir.empty()) {
+        std::error_code error = sys::fs::create_directories(options.output_dir);
+        if (error) {
+            cerr << "[ERROR] Cannot create " << options.output_dir << ": " << error.message() << endl;
+            return 1;
+        }
+    }
+
+    /*
+     * Every shard or cache unit holds its own context and target machine, so
+     * files and their functions share the -j threads instead of multiplying
+     * them: each of the file workers gets an even part of what is left.
+     */
+    unsigned file_workers = std::max<size_t>(1, std::min<size_t>(jobs, inputs.size()));
+    unsigned file_share = shards != 0 ? shards : std::max(1u, jobs / file_workers);
+
+    if (parallel_codegen)
+        options.function_shards = file_share;
+    options.cache_threads = file_share;
+
+    if (options.emit == EMIT_RUN && inputs.size() > 1) {
+        cerr << "[ERROR] --run takes a single source file" << endl;
+        return 1;
+    }
+
+    if (!trace_file.empty())
+        Trace::Enable();
+    if (options.stats)
+        Trace::EnableMemory();
+
+    int status = inputs.empty() ? compile_file("", options) : compile_files(inputs, options, jobs);
+
+    if (!trace_file.empty()) {
+        Trace::PrintSummary(cerr);
+        if (!Trace::WriteChromeTrace(trace_file))
+            cerr << "[ERROR] Cannot write trace " << trace_file << ": " << strerror(errno) << endl;
+    }
+
+    if (options.stats)
+        Trace::PrintMemory(cerr);
+
+    return status;
+}
@@ -1,20 +1,52 @@
 #include <iostream>
+#include <string.h>
+#include <errno.h>
 #include "codegen.hpp"
 #include "node.hpp"
+#include "parse.hpp"
+#include "source.hpp"
 
 using namespace std;
 
-extern int yyparse();
-extern NProgram* programBlock;
-
-int main()
+/* Dumps the IR of one program; path NULL reads stdin */
+static int dump(const char *path)
 {
-    yyparse();
+    NProgram *programBlock;
+
+    if (path == NULL) {
+        programBlock = ParseProgram(stdin, "<stdin>");
+    } else {
+        SourceFile source;
+        if (!source.Open(path)) {
+            cout << "[ERROR] Cannot open " << path << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        programBlock = ParseBuffer(source.ScanBuffer(), source.ScanSize(), path);
+    }
+
+    if (programBlock == NULL)
+        return 1;
+
     std::cout << programBlock << std::endl;
 
     CodeGenContext *context = new CodeGenContext();
     context->generateCode(*programBlock);
-    context->runCode();
-    
+    context->DumpIR();
+
+    delete context;
+    delete programBlock;
+
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+        return dump(NULL);
+
+    int status = 0;
+    for (int i = 1; i < argc; i++)
+        status |= dump(argv[i]);
+
+    return status;
+}
@@ -1,104 +1,35 @@
 #include <iostream>
 #include "node.hpp"
+#include "arena.hpp"
 
-/*bool Node::IsBaseExpression() {
-    if (dynamic_cast<NInteger*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NReal*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NStringLiteral*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NIdentifier*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NVariable*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NFunctionCall*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NBinaryOp*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NUnaryOp*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NExpression*>(this) != nullptr)
-        return true;
-    else
-        return false;
+NProgram::~NProgram() {
+    delete this->arena;
 }
-    
+
 bool Node::IsBaseStatement() {
-    if (dynamic_cast<NAssignment*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NExpressionStatement*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NVariableDecl*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NVariableCompoundDecl*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NFunctionDecl*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NIfStatement*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NForStatement*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NWhileStatement*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NPrintStatement*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NReadStatement*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NReturnStatement*>(this) != nullptr)
-        return false;
-    else if (dynamic_cast<NStatement*>(this) != nullptr)
-        return true;
-    else
-        return false;
-}*/
+    return this->kind == NODE_STATEMENT;
+}
+
+/* Forwards to the concrete class' DumpNode; placeholders print their base name */
+class DumpVisitor {
+public:
+    template <typename T>
+    void operator()(T& node) { node.T::DumpNode(); }
+
+    void operator()(NExpression& node) { std::cout << "NExpression()"; }
+    void operator()(NStatement& node) { std::cout << "NStatement()"; }
+};
+
+void Node::DumpNode() {
+    VisitNode(*this, DumpVisitor());
+}
 
 void NExpression::DumpNode() {
-    if (dynamic_cast<NInteger*>(this) != nullptr)
-        return dynamic_cast<NInteger*>(this)->DumpNode();
-    else if (dynamic_cast<NReal*>(this) != nullptr)
-        return dynamic_cast<NReal*>(this)->DumpNode();
-    else if (dynamic_cast<NStringLiteral*>(this) != nullptr)
-        return dynamic_cast<NStringLiteral*>(this)->DumpNode();
-    else if (dynamic_cast<NIdentifier*>(this) != nullptr)
-        return dynamic_cast<NIdentifier*>(this)->DumpNode();
-    else if (dynamic_cast<NVariable*>(this) != nullptr)
-        return dynamic_cast<NVariable*>(this)->DumpNode();
-    else if (dynamic_cast<NFunctionCall*>(this) != nullptr)
-        return dynamic_cast<NFunctionCall*>(this)->DumpNode();
-    else if (dynamic_cast<NBinaryOp*>(this) != nullptr)
-        return dynamic_cast<NBinaryOp*>(this)->DumpNode();
-    else if (dynamic_cast<NUnaryOp*>(this) != nullptr)
-        return dynamic_cast<NUnaryOp*>(this)->DumpNode();
-    else
-        std::cout << "NExpression()";
+    VisitNode(*this, DumpVisitor());
 }
 
 void NStatement::DumpNode() {
-    if (dynamic_cast<NAssignment*>(this) != nullptr)
-        return dynamic_cast<NAssignment*>(this)->DumpNode();
-    else if (dynamic_cast<NExpressionStatement*>(this) != nullptr)
-        return dynamic_cast<NExpressionStatement*>(this)->DumpNode();
-    else if (dynamic_cast<NVariableDecl*>(this) != nullptr)
-        return dynamic_cast<NVariableDecl*>(this)->DumpNode();
-    else if (dynamic_cast<NVariableCompoundDecl*>(this) != nullptr)
-        return dynamic_cast<NVariableCompoundDecl*>(this)->DumpNode();
-    else if (dynamic_cast<NFunctionDecl*>(this) != nullptr)
-        return dynamic_cast<NFunctionDecl*>(this)->DumpNode();
-    else if (dynamic_cast<NIfStatement*>(this) != nullptr)
-        return dynamic_cast<NIfStatement*>(this)->DumpNode();
-    else if (dynamic_cast<NForStatement*>(this) != nullptr)
-        return dynamic_cast<NForStatement*>(this)->DumpNode();
-    else if (dynamic_cast<NWhileStatement*>(this) != nullptr)
-        return dynamic_cast<NWhileStatement*>(this)->DumpNode();
-    else if (dynamic_cast<NPrintStatement*>(this) != nullptr)
-        return dynamic_cast<NPrintStatement*>(this)->DumpNode();
-    else if (dynamic_cast<NReadStatement*>(this) != nullptr)
-        return dynamic_cast<NReadStatement*>(this)->DumpNode();
-    else if (dynamic_cast<NReturnStatement*>(this) != nullptr)
-        return dynamic_cast<NReturnStatement*>(this)->DumpNode();
-    else
-        std::cout << "NStatement()";
+    VisitNode(*this, DumpVisitor());
 }
 
 void NInteger::DumpNode() {
@@ -122,7 +53,7 @@ void NVariable::DumpNode() {
     
     if (this->type == VARIABLE_ARRAY) {
         std::cout << "[";
-        this->arr_size.DumpNode();
+        this->arr_size->DumpNode();
         std::cout << "]";
     }
 
@@ -142,15 +73,15 @@ void NFunctionCall::DumpNode() {
 
 void NBinaryOp::DumpNode() {
     std::cout << "NBinaryOp(" << this->op << ", ";
-    this->lhs.DumpNode();
+    this->lhs->DumpNode();
     std::cout << ", ";
-    this->rhs.DumpNode();
+    this->rhs->DumpNode();
     std::cout << ")";
 }
 
 void NUnaryOp::DumpNode() {
     std::cout << "NUnaryOp(" << this->op << ", ";
-    this->expr.DumpNode();
+    this->expr->DumpNode();
     std::cout << ")";
 }
 
@@ -158,13 +89,13 @@ void NAssignment::DumpNode() {
     std::cout << "NAssignment(";
     this->lhs.DumpNode();
     std::cout << ", ";
-    this->rhs.DumpNode();
+    this->rhs->DumpNode();
     std::cout << ")";
 }
 
 void NExpressionStatement::DumpNode() {
     std::cout << "NExpressionStatement(";
-    this->expression.DumpNode();
+    this->expression->DumpNode();
     std::cout << ")";
 }
 
@@ -219,7 +150,7 @@ void NIfStatement::DumpNode() {
     bool first_iter = true;
 
     std::cout << "NIfStatement(";
-    this->condition.DumpNode();
+    this->condition->DumpNode();
     std::cout << ", (";
     
     for (int i = 0; i < this->then_body.size(); i++) {
@@ -247,11 +178,11 @@ void NForStatement::DumpNode() {
     std::cout << "NForStatement(";
     this->iterator.DumpNode();
     std::cout << ", ";
-    this->iter_assign.DumpNode();
+    this->iter_assign->DumpNode();
     std::cout << ", ";
-    this->iter_until.DumpNode();
+    this->iter_until->DumpNode();
     std::cout << ", ";
-    this->iter_by.DumpNode();
+    this->iter_by->DumpNode();
     std::cout << ", (";
     
     for (int i = 0; i < this->body.size(); i++) {
@@ -267,7 +198,7 @@ void NWhileStatement::DumpNode() {
     bool first_iter = true;
 
     std::cout << "NWhileStatement(";
-    this->condition.DumpNode();
+    this->condition->DumpNode();
     std::cout << ", (";
     
     for (int i = 0; i < this->body.size(); i++) {
@@ -309,7 +240,7 @@ void NReadStatement::DumpNode() {
 
 void NReturnStatement::DumpNode() {
     std::cout << "NReturnStatement(";
-    this->expression.DumpNode();
+    this->expression->DumpNode();
     std::cout << ")";
 }
 
@@ -5,14 +5,59 @@
 #include <vector>
 #include <llvm/IR/Value.h>
 
+#include "symbol.hpp"
+
 #define VARIABLE_BASIC  0
 #define VARIABLE_ARRAY  1
 
+/* Operators only the simplifier creates (simplify.hpp), numbered past the parser's tokens */
+#define OP_SHL      1000
+#define OP_ASHR     1001
+#define OP_LSHR     1002
+#define OP_BITAND   1003
+
+#define BINDING_UNRESOLVED  0
+#define BINDING_LOCAL       1
+#define BINDING_GLOBAL      2
+
 #define NODE_Dump_Typecast(x, o) ((x)o)->DumpNode()
 
+/* Concrete node classes, the tag VisitNode dispatches on */
+enum NodeKind {
+    NODE_EXPRESSION,
+    NODE_INTEGER,
+    NODE_REAL,
+    NODE_STRING_LITERAL,
+    NODE_IDENTIFIER,
+    NODE_VARIABLE,
+    NODE_FUNCTION_CALL,
+    NODE_BINARY_OP,
+    NODE_UNARY_OP,
+    NODE_STATEMENT,
+    NODE_ASSIGNMENT,
+    NODE_EXPRESSION_STATEMENT,
+    NODE_VARIABLE_DECL,
+    NODE_VARIABLE_COMPOUND_DECL,
+    NODE_FUNCTION_DECL,
+    NODE_IF,
+    NODE_FOR,
+    NODE_WHILE,
+    NODE_PRINT,
+    NODE_READ,
+    NODE_RETURN,
+    NODE_PROGRAM
+};
+
+/* Storage slot a variable name refers to, filled in by ResolveNames() */
+struct Binding {
+    int scope;
+    unsigned index;
+};
+
 typedef long long int IntegerType;
 typedef double RealType;
 
+class Arena;
 class CodeGenContext;
 class NStatement;
 class NExpression;
@@ -24,6 +69,8 @@ typedef std::vector<NVariableDecl*> VariableList;
 
 class Node {
 public:
+    NodeKind kind;
+    Node(NodeKind kind) : kind(kind) { }
     virtual ~Node() {}
 
     virtual llvm::Value* codeGen(CodeGenContext& context) { return NULL; }
@@ -33,12 +80,14 @@ public:
 
 class NExpression : public Node {
 public:
+    NExpression(NodeKind kind = NODE_EXPRESSION) : Node(kind) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
     void DumpNode();
 };
 
 class NStatement : public Node {
 public:
+    NStatement(NodeKind kind = NODE_STATEMENT) : Node(kind) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
     void DumpNode();
 };
@@ -46,7 +95,7 @@ public:
 class NInteger : public NExpression {
 public:
     IntegerType value;
-    NInteger(IntegerType value) : value(value) { }
+    NInteger(IntegerType value) : NExpression(NODE_INTEGER), value(value) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -56,7 +105,7 @@ public:
 class NReal : public NExpression {
 public:
     RealType value;
-    NReal(RealType value) : value(value) { }
+    NReal(RealType value) : NExpression(NODE_REAL), value(value) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -66,7 +115,7 @@ public:
 class NStringLiteral : public NExpression {
 public:
     std::string value;
-    NStringLiteral(std::string value) : value(value) { }
+    NStringLiteral(std::string value) : NExpression(NODE_STRING_LITERAL), value(value) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -75,8 +124,9 @@ public:
 
 class NIdentifier : public NExpression {
 public:
-    std::string name;
-    NIdentifier(std::string& name) : name(name) { }
+    Symbol name;
+    Binding binding;
+    NIdentifier(Symbol name) : NExpression(NODE_IDENTIFIER), name(name) { binding.scope = BINDING_UNRESOLVED; binding.index = 0; }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -87,9 +137,9 @@ class NVariable : public NExpression {
 public:
     NIdentifier& identifier;
     int type;
-    NExpression& arr_size;
+    NExpression *arr_size;
     NVariable(NIdentifier& identifier, int type, NExpression& arr_size) :
-        identifier(identifier), type(type), arr_size(arr_size) { }
+        NExpression(NODE_VARIABLE), identifier(identifier), type(type), arr_size(&arr_size) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -101,7 +151,7 @@ public:
     NIdentifier& id;
     ExpressionList& arguments;
     NFunctionCall(NIdentifier& id, ExpressionList& arguments) :
-        id(id), arguments(arguments) { }
+        NExpression(NODE_FUNCTION_CALL), id(id), arguments(arguments) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -111,10 +161,10 @@ public:
 class NBinaryOp : public NExpression {
 public:
     int op;
-    NExpression& lhs;
-    NExpression& rhs;
+    NExpression *lhs;
+    NExpression *rhs;
     NBinaryOp(NExpression& lhs, int op, NExpression& rhs) :
-        lhs(lhs), rhs(rhs), op(op) { }
+        NExpression(NODE_BINARY_OP), op(op), lhs(&lhs), rhs(&rhs) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -124,9 +174,9 @@ public:
 class NUnaryOp : public NExpression {
 public:
     int op;
-    NExpression& expr;
+    NExpression *expr;
     NUnaryOp(int op, NExpression& expr) :
-        op(op), expr(expr) { }
+        NExpression(NODE_UNARY_OP), op(op), expr(&expr) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -136,9 +186,9 @@ public:
 class NAssignment : public NStatement {
 public:
     NVariable& lhs;
-    NExpression& rhs;
+    NExpression *rhs;
     NAssignment(NVariable& lhs, NExpression& rhs) : 
-        lhs(lhs), rhs(rhs) { }
+        NStatement(NODE_ASSIGNMENT), lhs(lhs), rhs(&rhs) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -147,9 +197,9 @@ public:
 
 class NExpressionStatement : public NStatement {
 public:
-    NExpression& expression;
+    NExpression *expression;
     NExpressionStatement(NExpression& expression) : 
-        expression(expression) { }
+        NStatement(NODE_EXPRESSION_STATEMENT), expression(&expression) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -163,7 +213,7 @@ public:
     int type;
     int arr_size;
     NVariableDecl(NIdentifier& id, NIdentifier& type_id, int type, int arr_size) :
-        type_id(type_id), id(id), type(type), arr_size(arr_size) { }
+        NStatement(NODE_VARIABLE_DECL), type_id(type_id), id(id), type(type), arr_size(arr_size) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -173,7 +223,7 @@ public:
 class NVariableCompoundDecl : public NStatement {
 public:
     VariableList& decls;
-    NVariableCompoundDecl(VariableList& decls) : decls(decls) { }
+    NVariableCompoundDecl(VariableList& decls) : NStatement(NODE_VARIABLE_COMPOUND_DECL), decls(decls) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -186,9 +236,11 @@ public:
     NIdentifier& id;
     VariableList& arguments;
     StatementList& body;
+    unsigned num_locals;
     NFunctionDecl(NIdentifier& type, NIdentifier& id, VariableList& arguments, StatementList& body) :
-        type(type), id(id), arguments(arguments), body(body) { }
+        NStatement(NODE_FUNCTION_DECL), type(type), id(id), arguments(arguments), body(body), num_locals(0) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
+    llvm::Function* codeGenPrototype(CodeGenContext& context);
     
     
     void DumpNode();
@@ -196,11 +248,11 @@ public:
 
 class NIfStatement : public NStatement {
 public:
-    NExpression& condition;
+    NExpression *condition;
     StatementList& then_body;
     StatementList& else_body;
     NIfStatement(NExpression& condition, StatementList& then_body, StatementList& else_body) :
-        condition(condition), then_body(then_body), else_body(else_body) { }
+        NStatement(NODE_IF), condition(&condition), then_body(then_body), else_body(else_body) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -210,12 +262,12 @@ public:
 class NForStatement : public NStatement {
 public:
     NVariable& iterator;
-    NExpression& iter_assign;
-    NExpression& iter_until;
-    NExpression& iter_by;
+    NExpression *iter_assign;
+    NExpression *iter_until;
+    NExpression *iter_by;
     StatementList& body;
     NForStatement(NVariable& iterator, NExpression& iter_assign, NExpression& iter_until, NExpression& iter_by, StatementList& body) :
-        iterator(iterator), iter_assign(iter_assign), iter_until(iter_until), iter_by(iter_by), body(body) { }
+        NStatement(NODE_FOR), iterator(iterator), iter_assign(&iter_assign), iter_until(&iter_until), iter_by(&iter_by), body(body) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -224,9 +276,9 @@ public:
 
 class NWhileStatement : public NStatement {
 public:
-    NExpression& condition;
+    NExpression *condition;
     StatementList& body;
-    NWhileStatement(NExpression& condition, StatementList& body) : condition(condition), body(body) { }
+    NWhileStatement(NExpression& condition, StatementList& body) : NStatement(NODE_WHILE), condition(&condition), body(body) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -236,7 +288,7 @@ public:
 class NPrintStatement : public NStatement {
 public:
     ExpressionList& arguments;
-    NPrintStatement(ExpressionList& arguments) : arguments(arguments) { }
+    NPrintStatement(ExpressionList& arguments) : NStatement(NODE_PRINT), arguments(arguments) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -246,7 +298,7 @@ public:
 class NReadStatement : public NStatement {
 public:
     ExpressionList& destinations;
-    NReadStatement(ExpressionList& destinations) : destinations(destinations) { }
+    NReadStatement(ExpressionList& destinations) : NStatement(NODE_READ), destinations(destinations) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -255,8 +307,8 @@ public:
 
 class NReturnStatement : public NStatement {
 public:
-    NExpression& expression;
-    NReturnStatement(NExpression& expression) : expression(expression) { }
+    NExpression *expression;
+    NReturnStatement(NExpression& expression) : NStatement(NODE_RETURN), expression(&expression) { }
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
@@ -267,12 +319,51 @@ class NProgram : public Node {
 public:
     StatementList& variable_decl_stmts;
     StatementList& function_decl_stmts;
+    Arena *arena;   /* owns every node, list and token string below */
+    unsigned num_globals;
     NProgram(StatementList& variable_decl_stmts, StatementList& function_decl_stmts) :
-        variable_decl_stmts(variable_decl_stmts), function_decl_stmts(function_decl_stmts) { }
+        Node(NODE_PROGRAM), variable_decl_stmts(variable_decl_stmts), function_decl_stmts(function_decl_stmts), arena(NULL), num_globals(0) { }
+    ~NProgram();
     virtual llvm::Value* codeGen(CodeGenContext& context);
 
     
     void DumpNode();
 };
 
+/*
+ * Shared dispatch for every pass over the tree: calls visitor(concrete&) for
+ * the node's concrete class with one switch on the kind tag. The visitor
+ * needs an overload (or template) for each class, plus the NExpression and
+ * NStatement placeholders the parser creates for missing operands.
+ */
+template <typename Visitor>
+decltype(auto) VisitNode(Node& node, Visitor&& visitor)
+{
+    switch (node.kind) {
+        case NODE_INTEGER:                  return visitor(static_cast<NInteger&>(node));
+        case NODE_REAL:                     return visitor(static_cast<NReal&>(node));
+        case NODE_STRING_LITERAL:           return visitor(static_cast<NStringLiteral&>(node));
+        case NODE_IDENTIFIER:               return visitor(static_cast<NIdentifier&>(node));
+        case NODE_VARIABLE:                 return visitor(static_cast<NVariable&>(node));
+        case NODE_FUNCTION_CALL:            return visitor(static_cast<NFunctionCall&>(node));
+        case NODE_BINARY_OP:                return visitor(static_cast<NBinaryOp&>(node));
+        case NODE_UNARY_OP:                 return visitor(static_cast<NUnaryOp&>(node));
+        case NODE_ASSIGNMENT:               return visitor(static_cast<NAssignment&>(node));
+        case NODE_EXPRESSION_STATEMENT:     return visitor(static_cast<NExpressionStatement&>(node));
+        case NODE_VARIABLE_DECL:            return visitor(static_cast<NVariableDecl&>(node));
+        case NODE_VARIABLE_COMPOUND_DECL:   return visitor(static_cast<NVariableCompoundDecl&>(node));
+        case NODE_FUNCTION_DECL:            return visitor(static_cast<NFunctionDecl&>(node));
+        case NODE_IF:                       return visitor(static_cast<NIfStatement&>(node));
+        case NODE_FOR:                      return visitor(static_cast<NForStatement&>(node));
+        case NODE_WHILE:                    return visitor(static_cast<NWhileStatement&>(node));
+        case NODE_PRINT:                    return visitor(static_cast<NPrintStatement&>(node));
+        case NODE_READ:                     return visitor(static_cast<NReadStatement&>(node));
+        case NODE_RETURN:                   return visitor(static_cast<NReturnStatement&>(node));
+        case NODE_PROGRAM:                  return visitor(static_cast<NProgram&>(node));
+        case NODE_STATEMENT:                return visitor(static_cast<NStatement&>(node));
+        case NODE_EXPRESSION:
+        default:                            return visitor(static_cast<NExpression&>(node));
+    }
+}
+
 #endif
\ No newline at end of file
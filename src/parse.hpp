@@ -0,0 +1,39 @@
+#ifndef __PARSE_H
+#define __PARSE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "source.hpp"
+
+class Arena;
+class NProgram;
+struct yy_buffer_state;
+
+typedef void *yyscan_t;
+
+/*
+ * Everything one parse owns. The parser and the scanner are reentrant and
+ * keep their state here and in the scanner handle, so several files can be
+ * parsed at the same time on different threads.
+ */
+struct ParseState {
+    Arena *arena;           /* nodes of the parse in progress, handed to the program */
+    NProgram *program;
+    const char *filename;
+    int curr_line;
+    int curr_col;
+    int64_t lex_time;       /* nanoseconds spent in the scanner, only counted while tracing */
+};
+
+/* Parses a whole source file; NULL after a syntax error, which is reported on stdout */
+NProgram *ParseProgram(FILE *in, const char *filename);
+
+/*
+ * The same over text already in memory, scanned in place: the last
+ * SCAN_PADDING of the size bytes must be NULs, and the scanner writes into
+ * the rest while it runs (see SourceFile)
+ */
+NProgram *ParseBuffer(char *buffer, size_t size, const char *filename);
+
+#endif
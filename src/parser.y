@@ -1,23 +1,43 @@
+%code requires {
+    #include "parse.hpp"
+}
+
 %{
     #include "node.hpp"
+    #include "arena.hpp"
     #include "parser.hpp"
+    #include "trace.hpp"
 
-    extern int yylineno;
-    extern YYLTYPE yylloc;
+    extern int yylex(YYSTYPE *lvalp, YYLTYPE *llocp, yyscan_t scanner);
+    extern ParseState *yyget_extra(yyscan_t scanner);
 
-    NProgram *programBlock;
+    /* Scanning and parsing interleave, so the scanner's share is summed up token by token */
+    static int timed_yylex(YYSTYPE *lvalp, YYLTYPE *llocp, yyscan_t scanner) {
+        if (!Trace::Enabled())
+            return yylex(lvalp, llocp, scanner);
 
-    extern int yylex();
+        int64_t start = Trace::Now();
+        int token = yylex(lvalp, llocp, scanner);
+        yyget_extra(scanner)->lex_time += Trace::Now() - start;
+        return token;
+    }
+    #define yylex timed_yylex
 
-    void yyerror(const char *s) {
-        printf("ERROR: %s (Location: %d:%d/%d:%d)\n", s,
-            yylloc.first_line, yylloc.first_column, yylloc.last_line,
-            yylloc.last_column);
+    void yyerror(YYLTYPE *llocp, yyscan_t scanner, ParseState *state, const char *s) {
+        printf("ERROR: %s (Location: %s:%d:%d/%d:%d)\n", s, state->filename,
+            llocp->first_line, llocp->first_column, llocp->last_line,
+            llocp->last_column);
     }
 %}
 
 %locations
+%define api.pure full
 %define parse.error verbose
+%lex-param { yyscan_t scanner }
+%parse-param { yyscan_t scanner } { ParseState *state }
+
+/* Every node, list and token string of this parse lives in a fresh arena */
+%initial-action { state->arena = new Arena(); }
 
 /* Represents the many different ways we can access our data */
 %union {
@@ -32,10 +52,12 @@
     std::vector<NExpression*> *exprvec;
     std::vector<NStatement*> *stmtvec;
     std::string *string;
+    Symbol symbol;
     int token;
 }
 
-%token <string> TIDENTIFIER TINTEGER TDOUBLE TSTRINGLIT
+%token <symbol> TIDENTIFIER
+%token <string> TINTEGER TDOUBLE TSTRINGLIT
 %token <token> TCEQ TCNE TCLT TCLE TCGT TCGE TEQUAL
 %token <token> TLPAREN TRPAREN TLBRACE TRBRACE TCOMMA TDOT TSEMICOLON TCOLON TASSIGN
 %token <token> TPLUS TMINUS TMUL TDIV TNUMMOD TNUMDIV
@@ -60,28 +82,28 @@
 %%
 
 program
-        : global_var_decl_list function_decl_list {programBlock = new NProgram(*$1, *$2);}
+        : global_var_decl_list function_decl_list {state->program = new NProgram(*$1, *$2); state->program->arena = state->arena; state->arena = NULL;}
         ;
 
 global_var_decl_list
-        : variable_decl_statement                       {$$ = new StatementList(); $$->push_back($<stmt>1);}
+        : variable_decl_statement                       {$$ = state->arena->make<StatementList>(); $$->push_back($<stmt>1);}
         | global_var_decl_list variable_decl_statement  {$1->push_back($<stmt>2);}
         ;
 
 function_decl_list
-        : function_decl                         {$$ = new StatementList(); $$->push_back($<stmt>1);}
+        : function_decl                         {$$ = state->arena->make<StatementList>(); $$->push_back($<stmt>1);}
         | function_decl_list function_decl      {$1->push_back($<stmt>2);}
         ;
 
 stmt_list
-        : statement             {$$ = new StatementList(); $$->push_back($<stmt>1);}
+        : statement             {$$ = state->arena->make<StatementList>(); $$->push_back($<stmt>1);}
         | stmt_list statement   {$1->push_back($<stmt>2);}
         ;
 
 statement
         : assignment_statement TSEMICOLON
         | return_statement TSEMICOLON
-        | expression TSEMICOLON                 {$$ = new NExpressionStatement(*$1);}
+        | expression TSEMICOLON                 {$$ = state->arena->make<NExpressionStatement>(*$1);}
         | variable_decl_statement
         | function_decl TSEMICOLON
         | if_statement TSEMICOLON
@@ -92,11 +114,11 @@ statement
         ;
 
 assignment_statement
-        : variable TASSIGN expression   {$$ = new NAssignment(*$<variable>1, *$3);}
+        : variable TASSIGN expression   {$$ = state->arena->make<NAssignment>(*$<variable>1, *$3);}
         ;
     
 return_statement
-        : TRETURN expression    {$$ = new NReturnStatement(*$2);}
+        : TRETURN expression    {$$ = state->arena->make<NReturnStatement>(*$2);}
         ;
 
 variable_decl_statement
@@ -104,54 +126,54 @@ variable_decl_statement
         ;
 
 variable_decl_list
-        : variable_decl                             {$$ = new NVariableCompoundDecl(*(new VariableList())); $<var_comp_decl>$->decls.push_back($<var_decl>1);}
+        : variable_decl                             {$$ = state->arena->make<NVariableCompoundDecl>(*(state->arena->make<VariableList>())); $<var_comp_decl>$->decls.push_back($<var_decl>1);}
         | variable_decl_list TCOMMA variable_decl   {$<var_comp_decl>1->decls.push_back($<var_decl>3);}
         ;
 
 variable_decl
-        : identifier TCOLON identifier                                      {$$ = new NVariableDecl(*$1, *$3, VARIABLE_BASIC, 0);}
-        | identifier TCOLON identifier TLBRACE TRBRACE                      {$$ = new NVariableDecl(*$1, *$3, VARIABLE_ARRAY, 0);}
-        | identifier TCOLON identifier TLBRACE integer_expression TRBRACE   {$$ = new NVariableDecl(*$1, *$3, VARIABLE_ARRAY, $<integer>5->value);}
+        : identifier TCOLON identifier                                      {$$ = state->arena->make<NVariableDecl>(*$1, *$3, VARIABLE_BASIC, 0);}
+        | identifier TCOLON identifier TLBRACE TRBRACE                      {$$ = state->arena->make<NVariableDecl>(*$1, *$3, VARIABLE_ARRAY, 0);}
+        | identifier TCOLON identifier TLBRACE integer_expression TRBRACE   {$$ = state->arena->make<NVariableDecl>(*$1, *$3, VARIABLE_ARRAY, $<integer>5->value);}
         ;
 
 variable
-        : identifier                                        {$$ = new NVariable(*$1, VARIABLE_BASIC, *(new NExpression()));}
-        | identifier TLBRACE expression TRBRACE     {$$ = new NVariable(*$1, VARIABLE_ARRAY, *$3);}
+        : identifier                                        {$$ = state->arena->make<NVariable>(*$1, VARIABLE_BASIC, *(state->arena->make<NExpression>()));}
+        | identifier TLBRACE expression TRBRACE     {$$ = state->arena->make<NVariable>(*$1, VARIABLE_ARRAY, *$3);}
         ;
 
 function_decl
-        : identifier TFUNC identifier TLPAREN TRPAREN stmt_list TENDFUNC                      {$$ = new NFunctionDecl(*$1, *$3, *(new VariableList()), *$6);}
-        | identifier TFUNC identifier TLPAREN variable_decl_list TRPAREN stmt_list TENDFUNC   {$$ = new NFunctionDecl(*$1, *$3, $<var_comp_decl>5->decls, *$7);}
+        : identifier TFUNC identifier TLPAREN TRPAREN stmt_list TENDFUNC                      {$$ = state->arena->make<NFunctionDecl>(*$1, *$3, *(state->arena->make<VariableList>()), *$6);}
+        | identifier TFUNC identifier TLPAREN variable_decl_list TRPAREN stmt_list TENDFUNC   {$$ = state->arena->make<NFunctionDecl>(*$1, *$3, $<var_comp_decl>5->decls, *$7);}
         ;
 
 if_statement
-        : TIF expression TTHEN stmt_list TENDIF                 {$$ = new NIfStatement(*$2, *$4, *(new StatementList()));}
-        | TIF expression TTHEN stmt_list TELSE stmt_list TENDIF {$$ = new NIfStatement(*$2, *$4, *$6);}
+        : TIF expression TTHEN stmt_list TENDIF                 {$$ = state->arena->make<NIfStatement>(*$2, *$4, *(state->arena->make<StatementList>()));}
+        | TIF expression TTHEN stmt_list TELSE stmt_list TENDIF {$$ = state->arena->make<NIfStatement>(*$2, *$4, *$6);}
         ;
 
 for_statement
-        : TFOR variable TASSIGN expression TTO expression stmt_list TENDFOR {$$ = new NForStatement(*$<variable>2, *$4, *$6, *(new NExpression()), *$7);}
-        | TFOR variable TASSIGN expression TTO expression TBY expression stmt_list TENDFOR {$$ = new NForStatement(*$<variable>2, *$4, *$6, *$8, *$9);}
+        : TFOR variable TASSIGN expression TTO expression stmt_list TENDFOR {$$ = state->arena->make<NForStatement>(*$<variable>2, *$4, *$6, *(state->arena->make<NExpression>()), *$7);}
+        | TFOR variable TASSIGN expression TTO expression TBY expression stmt_list TENDFOR {$$ = state->arena->make<NForStatement>(*$<variable>2, *$4, *$6, *$8, *$9);}
         ;
 
 while_statement
-        : TWHILE expression TDO stmt_list TENDWHILE {$$ = new NWhileStatement(*$2, *$4);}
+        : TWHILE expression TDO stmt_list TENDWHILE {$$ = state->arena->make<NWhileStatement>(*$2, *$4);}
 
 print_statement
-        : TPRINT print_arg_list             {$$ = new NPrintStatement(*$2);}
+        : TPRINT print_arg_list             {$$ = state->arena->make<NPrintStatement>(*$2);}
         ;
 
 print_arg_list
-        : expression                        {$$ = new ExpressionList(); $$->push_back($1);}
+        : expression                        {$$ = state->arena->make<ExpressionList>(); $$->push_back($1);}
         | print_arg_list TCOMMA expression  {$1->push_back($3);}
         ;
 
 read_statement                              
-        : TREAD read_arg_list               {$$ = new NReadStatement(*$2);}
+        : TREAD read_arg_list               {$$ = state->arena->make<NReadStatement>(*$2);}
         ;
 
 read_arg_list
-        : variable                          {$$ = new ExpressionList(); $$->push_back($1);}
+        : variable                          {$$ = state->arena->make<ExpressionList>(); $$->push_back($1);}
         | read_arg_list TCOMMA variable     {$1->push_back($3);}
         ;
 
@@ -167,33 +189,33 @@ expression
         ;
 
 integer_expression
-        : TINTEGER {$$ = new NInteger(atol($1->c_str()));}
+        : TINTEGER {$$ = state->arena->make<NInteger>(atol($1->c_str()));}
         ;
 
 real_expression
-        : TDOUBLE {$$ = new NReal(atof($1->c_str()));}
+        : TDOUBLE {$$ = state->arena->make<NReal>(atof($1->c_str()));}
         ;
 
 string_literal_expression
-        : TSTRINGLIT {$$ = new NStringLiteral(*$1);}
+        : TSTRINGLIT {$$ = state->arena->make<NStringLiteral>(*$1);}
         ;
 
 identifier
-        : TIDENTIFIER {$$ = new NIdentifier(*$1);}
+        : TIDENTIFIER {$$ = state->arena->make<NIdentifier>($1);}
         ;
 
 function_call_expression
-        : identifier TLPAREN function_call_arg_list TRPAREN {$$ = new NFunctionCall(*$1, *$3);}
+        : identifier TLPAREN function_call_arg_list TRPAREN {$$ = state->arena->make<NFunctionCall>(*$1, *$3);}
         ;
 
 function_call_arg_list
-        : /* blank */ {$$ = new ExpressionList();}
-        | expression  {$$ = new ExpressionList(); $$->push_back($1);}
+        : /* blank */ {$$ = state->arena->make<ExpressionList>();}
+        | expression  {$$ = state->arena->make<ExpressionList>(); $$->push_back($1);}
         | function_call_arg_list TCOMMA expression {$1->push_back($3);}
         ;
 
 binaryop_expression
-        : expression binaryop expression {$$ = new NBinaryOp(*$1, $2, *$3);}
+        : expression binaryop expression {$$ = state->arena->make<NBinaryOp>(*$1, $2, *$3);}
         ;
 
 binaryop
@@ -204,11 +226,74 @@ binaryop
         ; 
 
 unaryop_expression
-        : unaryop expression {$$ = new NUnaryOp($1, *$2);}
+        : unaryop expression {$$ = state->arena->make<NUnaryOp>($1, *$2);}
         ;
 
 unaryop
         : TMINUS | TLOGICNOT
         ;
 
-%%
\ No newline at end of file
+%%
+
+/* Generated by flex in tokens.cpp */
+int yylex_init_extra(ParseState *extra, yyscan_t *scanner);
+void yyset_in(FILE *in, yyscan_t scanner);
+yy_buffer_state *yy_scan_buffer(char *base, size_t size, yyscan_t scanner);
+int yylex_destroy(yyscan_t scanner);
+
+/* Runs the parser over a scanner whose input is set up, then releases it */
+static NProgram *parse_scanner(ParseState& state, yyscan_t scanner, int64_t start)
+{
+    int result = yyparse(scanner, &state);
+    yylex_destroy(scanner);
+
+    /* One event for all tokens, at the start of the parse it is part of */
+    if (Trace::Enabled())
+        Trace::Add("lex", TRACE_PHASE, start, state.lex_time, state.filename);
+
+    /* After a syntax error the partial tree goes away with its arena */
+    delete state.arena;
+
+    if (result != 0) {
+        delete state.program;
+        return NULL;
+    }
+
+    return state.program;
+}
+
+NProgram *ParseProgram(FILE *in, const char *filename)
+{
+    TraceScope trace("parse", TRACE_PHASE, filename);
+    ParseState state = { NULL, NULL, filename, 1, 1, 0 };
+    yyscan_t scanner;
+    int64_t start = Trace::Enabled() ? Trace::Now() : 0;
+
+    if (yylex_init_extra(&state, &scanner) != 0)
+        return NULL;
+
+    yyset_in(in, scanner);
+    return parse_scanner(state, scanner, start);
+}
+
+NProgram *ParseBuffer(char *buffer, size_t size, const char *filename)
+{
+    TraceScope trace("parse", TRACE_PHASE, filename);
+    ParseState state = { NULL, NULL, filename, 1, 1, 0 };
+    yyscan_t scanner;
+    int64_t start = Trace::Enabled() ? Trace::Now() : 0;
+
+    if (size < SCAN_PADDING || buffer[size - 1] != 0 || buffer[size - 2] != 0)
+        return NULL;
+
+    if (yylex_init_extra(&state, &scanner) != 0)
+        return NULL;
+
+    /* Owned by the scanner handle, yylex_destroy frees it but not the text */
+    if (yy_scan_buffer(buffer, size, scanner) == NULL) {
+        yylex_destroy(scanner);
+        return NULL;
+    }
+
+    return parse_scanner(state, scanner, start);
+}
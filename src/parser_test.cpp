@@ -1,14 +1,46 @@
 #include <iostream>
+#include <string.h>
+#include <errno.h>
 #include "node.hpp"
-extern NProgram* programBlock;
-extern int yyparse();
+#include "parse.hpp"
+#include "source.hpp"
 
-int main(int argc, char **argv)
+/* Dumps one program; path NULL reads stdin */
+static int dump(const char *path)
 {
-    yyparse();
+    NProgram *programBlock;
+
+    if (path == NULL) {
+        programBlock = ParseProgram(stdin, "<stdin>");
+    } else {
+        SourceFile source;
+        if (!source.Open(path)) {
+            std::cout << "[ERROR] Cannot open " << path << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+        programBlock = ParseBuffer(source.ScanBuffer(), source.ScanSize(), path);
+    }
+
+    if (programBlock == NULL)
+        return 1;
 
     std::cout << programBlock << std::endl;
+
     programBlock->DumpNode();
 
+    delete programBlock;
+
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+        return dump(NULL);
+
+    int status = 0;
+    for (int i = 1; i < argc; i++)
+        status |= dump(argv[i]);
+
+    return status;
+}
@@ -0,0 +1,205 @@
+#include <limits.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/ProfileSummary.h>
+#include <llvm/ProfileData/InstrProf.h>
+#include <llvm/ProfileData/ProfileCommon.h>
+#include <llvm/Support/LineIterator.h>
+#include "codegen.hpp"
+#include "runtime.hpp"
+#include "trace.hpp"
+
+#define PROFILE_COUNTERS    "vlprof.counters"
+#define PROFILE_TABLE       "vlprof.functions"
+
+static void err_and_halt(std::string msg) {
+    std::cout << std::endl << "[ERROR] " << msg << std::endl;
+    abort();
+}
+
+/* Functions that get counters: everything the program defines except _start, which writes them */
+static bool profiled(Function& func)
+{
+    return !func.isDeclaration() && func.getName() != START_FUNC;
+}
+
+/* FNV-1a over the shape of the CFG, so a profile of a different version of a function is ignored */
+static uint64_t cfg_hash(Function& func)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](uint64_t value) {
+        for (int i = 0; i < 8; i++, value >>= 8)
+            hash = (hash ^ (value & 0xFF)) * 1099511628211ULL;
+    };
+
+    add(func.size());
+    for (BasicBlock& block : func)
+        add(block.getTerminator() == NULL ? 0 : block.getTerminator()->getNumSuccessors());
+
+    return hash;
+}
+
+/* Two-way branches in block order; counter 1 + 2i counts branch i taken, 2 + 2i not taken */
+static std::vector<BranchInst*> conditional_branches(Function& func)
+{
+    std::vector<BranchInst*> branches;
+
+    for (BasicBlock& block : func) {
+        BranchInst *branch = dyn_cast_or_null<BranchInst>(block.getTerminator());
+        if (branch != NULL && branch->isConditional())
+            branches.push_back(branch);
+    }
+
+    return branches;
+}
+
+static void increment(IRBuilder<>& builder, GlobalVariable *counters, Value *index)
+{
+    Type *i64 = builder.getInt64Ty();
+    Value *indices[] = { builder.getInt64(0), index };
+    Value *slot = builder.CreateInBoundsGEP(counters->getValueType(), counters, indices);
+
+    builder.CreateStore(builder.CreateAdd(builder.CreateLoad(i64, slot), builder.getInt64(1)), slot);
+}
+
+/*
+ * Instruments the module for --profile-generate: every function counts its
+ * calls and the outcome of each conditional branch in a private array, and
+ * _start hands all arrays to vl_profile_write() before returning. Runs on the
+ * unoptimized module, the same one ApplyProfile() later annotates.
+ */
+void CodeGenContext::AddProfileCounters(std::string profile_path)
+{
+    TraceScope trace("profile");
+    LLVMContext& ctx = *this->llvm_context;
+    Type *i64 = Type::getInt64Ty(ctx);
+    Type *str = Type::getInt8PtrTy(ctx);
+    StructType *entry_type = StructType::get(ctx, { str, i64, PointerType::getUnqual(i64), i64 });
+    std::vector<Constant*> table;
+
+    Function *start_func = this->module->getFunction(START_FUNC);
+    if (start_func == NULL)
+        err_and_halt("Profile: Module has no " START_FUNC " function");
+
+    for (Function& func : *this->module) {
+        if (!profiled(func))
+            continue;
+
+        uint64_t hash = cfg_hash(func);
+        std::vector<BranchInst*> branches = conditional_branches(func);
+        ArrayType *counters_type = ArrayType::get(i64, 1 + 2 * branches.size());
+        GlobalVariable *counters = new GlobalVariable(*this->module, counters_type, false,
+            GlobalValue::PrivateLinkage, Constant::getNullValue(counters_type), PROFILE_COUNTERS);
+
+        BasicBlock& entry = func.getEntryBlock();
+        BasicBlock::iterator pos = entry.begin();
+        while (isa<AllocaInst>(*pos))
+            pos++;
+
+        IRBuilder<> builder(&entry, pos);
+        increment(builder, counters, builder.getInt64(0));
+
+        for (size_t i = 0; i < branches.size(); i++) {
+            builder.SetInsertPoint(branches[i]);
+            increment(builder, counters, builder.CreateSelect(branches[i]->getCondition(),
+                builder.getInt64(1 + 2 * i), builder.getInt64(2 + 2 * i)));
+        }
+
+        Constant *indices[] = { ConstantInt::get(i64, 0), ConstantInt::get(i64, 0) };
+        table.push_back(ConstantStruct::get(entry_type, {
+            this->GetStringConstant(func.getName()),
+            ConstantInt::get(i64, hash),
+            ConstantExpr::getInBoundsGetElementPtr(counters_type, counters, indices),
+            ConstantInt::get(i64, counters_type->getNumElements()) }));
+    }
+
+    ArrayType *table_type = ArrayType::get(entry_type, table.size());
+    GlobalVariable *table_var = new GlobalVariable(*this->module, table_type, true,
+        GlobalValue::PrivateLinkage, ConstantArray::get(table_type, table), PROFILE_TABLE);
+
+    FunctionType *write_type = FunctionType::get(Type::getVoidTy(ctx), { PointerType::getUnqual(entry_type), i64, str }, false);
+    FunctionCallee write_func = this->module->getOrInsertFunction(PROFILE_WRITE_FUNC, write_type);
+
+    std::vector<ReturnInst*> returns;
+    for (BasicBlock& block : *start_func)
+        if (ReturnInst *ret = dyn_cast_or_null<ReturnInst>(block.getTerminator()))
+            returns.push_back(ret);
+
+    for (ReturnInst *ret : returns) {
+        IRBuilder<> builder(ret);
+        Value *indices[] = { builder.getInt64(0), builder.getInt64(0) };
+
+        builder.CreateCall(write_func, {
+            builder.CreateInBoundsGEP(table_type, table_var, indices),
+            builder.getInt64(table.size()),
+            this->GetStringConstant(profile_path) });
+    }
+}
+
+/* Branch weights are 32-bit, larger counts are scaled down together */
+static MDNode *branch_weights(MDBuilder& md, uint64_t taken, uint64_t not_taken)
+{
+    uint64_t scale = std::max(taken, not_taken) / UINT32_MAX + 1;
+
+    return md.createBranchWeights(uint32_t(taken / scale), uint32_t(not_taken / scale));
+}
+
+/*
+ * Annotates the freshly generated module for --profile-use: function entry
+ * counts, branch weights and the module's profile summary, which the
+ * optimizer then uses for inlining, block placement and hot/cold splitting.
+ * Functions whose CFG no longer matches the profile are left alone.
+ */
+void CodeGenContext::ApplyProfile(std::string profile_path)
+{
+    TraceScope trace("profile");
+    ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(profile_path);
+    if (!buffer)
+        err_and_halt("Profile: Cannot read " + profile_path + ": " + buffer.getError().message());
+
+    line_iterator line(**buffer);
+    if (line.is_at_end() || *line != PROFILE_MAGIC)
+        err_and_halt("Profile: " + profile_path + " is not a VLang profile");
+
+    MDBuilder md(*this->llvm_context);
+    InstrProfSummaryBuilder summary(ProfileSummaryBuilder::DefaultCutoffs);
+    unsigned applied = 0, stale = 0;
+
+    for (++line; !line.is_at_end(); ++line) {
+        SmallVector<StringRef, 16> fields;
+        uint64_t hash, count;
+
+        line->split(fields, ' ', -1, false);
+        if (fields.size() < 3 || fields[1].getAsInteger(10, hash) || fields[2].getAsInteger(10, count)
+                || fields.size() != 3 + count || count == 0)
+            err_and_halt("Profile: Malformed line in " + profile_path + ": " + line->str());
+
+        std::vector<uint64_t> counters(count);
+        for (uint64_t i = 0; i < count; i++)
+            if (fields[3 + i].getAsInteger(10, counters[i]))
+                err_and_halt("Profile: Malformed line in " + profile_path + ": " + line->str());
+
+        Function *func = this->module->getFunction(fields[0]);
+        std::vector<BranchInst*> branches;
+        if (func != NULL && profiled(*func))
+            branches = conditional_branches(*func);
+
+        if (func == NULL || !profiled(*func) || cfg_hash(*func) != hash || count != 1 + 2 * branches.size()) {
+            stale++;
+            continue;
+        }
+
+        func->setEntryCount(Function::ProfileCount(counters[0], Function::PCT_Real));
+        for (size_t i = 0; i < branches.size(); i++)
+            if (counters[1 + 2 * i] != 0 || counters[2 + 2 * i] != 0)
+                branches[i]->setMetadata(LLVMContext::MD_prof, branch_weights(md, counters[1 + 2 * i], counters[2 + 2 * i]));
+
+        summary.addRecord(InstrProfRecord(counters));
+        applied++;
+    }
+
+    if (stale != 0)
+        std::cerr << "[WARN] Profile: " << stale << " function(s) in " << profile_path << " do not match the program, ignored" << std::endl;
+
+    if (applied != 0)
+        this->module->setProfileSummary(summary.getSummary()->getMD(*this->llvm_context), ProfileSummary::PSK_Instr);
+}
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <unordered_map>
+#include "resolve.hpp"
+#include "trace.hpp"
+
+typedef std::unordered_map<Symbol, unsigned> ScopeMap;
+
+class NameResolver {
+    ScopeMap globals;
+    ScopeMap locals;
+    unsigned num_globals;
+    unsigned num_locals;
+    bool in_function;
+    Symbol func_name;
+
+public:
+    int errors;
+
+    NameResolver() : num_globals(0), num_locals(0), in_function(false), errors(0) { }
+
+    unsigned GlobalCount() const { return this->num_globals; }
+
+    void declare(NVariableDecl& decl) {
+        Binding& binding = decl.id.binding;
+
+        if (this->in_function) {
+            binding.scope = BINDING_LOCAL;
+            binding.index = this->num_locals++;
+            this->locals[decl.id.name] = binding.index;
+        } else {
+            binding.scope = BINDING_GLOBAL;
+            binding.index = this->num_globals++;
+            this->globals[decl.id.name] = binding.index;
+        }
+    }
+
+    void use(NIdentifier& id) {
+        ScopeMap::const_iterator it;
+
+        if (this->in_function && (it = this->locals.find(id.name)) != this->locals.end()) {
+            id.binding.scope = BINDING_LOCAL;
+            id.binding.index = it->second;
+        } else if ((it = this->globals.find(id.name)) != this->globals.end()) {
+            id.binding.scope = BINDING_GLOBAL;
+            id.binding.index = it->second;
+        } else {
+            std::cout << "[ERROR] undeclared variable " << id.name;
+            if (this->in_function)
+                std::cout << " (in function " << this->func_name << ")";
+            std::cout << std::endl;
+            this->errors++;
+        }
+    }
+
+    void walk(Node& node) { VisitNode(node, *this); }
+
+    void walk(StatementList& list) {
+        for (StatementList::iterator it = list.begin(); it != list.end(); it++)
+            this->walk(**it);
+    }
+
+    void walk(ExpressionList& list) {
+        for (ExpressionList::iterator it = list.begin(); it != list.end(); it++)
+            this->walk(**it);
+    }
+
+    void operator()(NInteger& node) { }
+    void operator()(NReal& node) { }
+    void operator()(NStringLiteral& node) { }
+    void operator()(NIdentifier& node) { this->use(node); }
+
+    void operator()(NVariable& node) {
+        this->use(node.identifier);
+        if (node.type == VARIABLE_ARRAY)
+            this->walk(*node.arr_size);
+    }
+
+    void operator()(NFunctionCall& node) { this->walk(node.arguments); }
+    void operator()(NBinaryOp& node) { this->walk(*node.lhs); this->walk(*node.rhs); }
+    void operator()(NUnaryOp& node) { this->walk(*node.expr); }
+
+    void operator()(NAssignment& node) { this->walk(node.lhs); this->walk(*node.rhs); }
+    void operator()(NExpressionStatement& node) { this->walk(*node.expression); }
+    void operator()(NVariableDecl& node) { this->declare(node); }
+
+    void operator()(NVariableCompoundDecl& node) {
+        for (VariableList::iterator it = node.decls.begin(); it != node.decls.end(); it++)
+            this->declare(**it);
+    }
+
+    /* Each function (nested ones included) gets its own, fresh local scope */
+    void operator()(NFunctionDecl& node) {
+        ScopeMap outer_locals;
+        outer_locals.swap(this->locals);
+        unsigned outer_count = this->num_locals;
+        bool outer_in_function = this->in_function;
+        Symbol outer_name = this->func_name;
+
+        this->num_locals = 0;
+        this->in_function = true;
+        this->func_name = node.id.name;
+
+        for (VariableList::iterator it = node.arguments.begin(); it != node.arguments.end(); it++)
+            this->declare(**it);
+        this->walk(node.body);
+
+        node.num_locals = this->num_locals;
+
+        this->locals.swap(outer_locals);
+        this->num_locals = outer_count;
+        this->in_function = outer_in_function;
+        this->func_name = outer_name;
+    }
+
+    void operator()(NIfStatement& node) {
+        this->walk(*node.condition);
+        this->walk(node.then_body);
+        this->walk(node.else_body);
+    }
+
+    void operator()(NForStatement& node) {
+        this->walk(node.iterator);
+        this->walk(*node.iter_assign);
+        this->walk(*node.iter_until);
+        this->walk(*node.iter_by);
+        this->walk(node.body);
+    }
+
+    void operator()(NWhileStatement& node) { this->walk(*node.condition); this->walk(node.body); }
+    void operator()(NPrintStatement& node) { this->walk(node.arguments); }
+    void operator()(NReadStatement& node) { this->walk(node.destinations); }
+    void operator()(NReturnStatement& node) { this->walk(*node.expression); }
+
+    void operator()(NProgram& node) {
+        this->walk(node.variable_decl_stmts);
+        this->walk(node.function_decl_stmts);
+    }
+
+    void operator()(NStatement& node) { }
+    void operator()(NExpression& node) { }
+};
+
+int ResolveNames(NProgram& root)
+{
+    TraceScope trace("resolve");
+    NameResolver resolver;
+
+    resolver.walk(root);
+    root.num_globals = resolver.GlobalCount();
+
+    return resolver.errors;
+}
@@ -0,0 +1,14 @@
+#ifndef __RESOLVE_H
+#define __RESOLVE_H
+
+#include "node.hpp"
+
+/*
+ * Binds every variable reference to a storage slot before code generation:
+ * globals get ids in declaration order, locals (parameters first) get
+ * per-function indices. Undeclared names are all reported up front.
+ * Returns the number of errors.
+ */
+int ResolveNames(NProgram& root);
+
+#endif
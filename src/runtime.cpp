@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "runtime.hpp"
+
+/* stdin is read in big blocks with read(2) and parsed in place, never through scanf */
+static char read_buffer[READ_BUFFER_SIZE];
+static size_t read_pos = 0, read_end = 0;
+static bool read_eof = false;
+
+/* Keeps the unread bytes and appends as much input as fits after them */
+static void refill()
+{
+    /* Whatever the program printed so far (a prompt, usually) must be visible before we block */
+    fflush(stdout);
+
+    memmove(read_buffer, read_buffer + read_pos, read_end - read_pos);
+    read_end -= read_pos;
+    read_pos = 0;
+
+    while (read_end < READ_BUFFER_SIZE && !read_eof) {
+        ssize_t got = read(0, read_buffer + read_end, READ_BUFFER_SIZE - read_end);
+
+        if (got <= 0)
+            read_eof = true;
+        else
+            read_end += got;
+
+        /* Interactive input arrives a line at a time, do not wait for a full buffer */
+        if (got > 0 && memchr(read_buffer + read_end - got, '\n', got) != NULL)
+            break;
+    }
+}
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/* Drops what is left of the current token, so a malformed one cannot stall every later read */
+static void skip_token()
+{
+    while (read_pos < read_end && !is_space(read_buffer[read_pos]))
+        read_pos++;
+}
+
+/* Skips whitespace and makes sure the next token is entirely in the buffer; false at end of input */
+static bool next_token()
+{
+    for (;;) {
+        while (read_pos < read_end && is_space(read_buffer[read_pos]))
+            read_pos++;
+
+        if (read_pos < read_end && (read_end - read_pos >= READ_TOKEN_MAX || read_eof
+                || memchr(read_buffer + read_pos, '\n', read_end - read_pos) != NULL))
+            return true;
+
+        if (read_eof)
+            return false;
+
+        refill();
+    }
+}
+
+extern "C" int64_t vl_read_int()
+{
+    if (!next_token())
+        return 0;
+
+    bool negative = false;
+    if (read_buffer[read_pos] == '-' || read_buffer[read_pos] == '+')
+        negative = read_buffer[read_pos++] == '-';
+
+    int64_t value = 0;
+    while (read_pos < read_end && read_buffer[read_pos] >= '0' && read_buffer[read_pos] <= '9')
+        value = value * 10 + (read_buffer[read_pos++] - '0');
+
+    /* "abc" reads as 0 and "3.5" as 3, like atoll */
+    skip_token();
+
+    return negative ? -value : value;
+}
+
+extern "C" double vl_read_real()
+{
+    if (!next_token())
+        return 0.0;
+
+    char token[READ_TOKEN_MAX + 1];
+    size_t len = 0;
+
+    while (read_pos < read_end && len < READ_TOKEN_MAX && !is_space(read_buffer[read_pos]))
+        token[len++] = read_buffer[read_pos++];
+
+    skip_token();
+
+    token[len] = '\0';
+    return strtod(token, NULL);
+}
+
+/* Called by _start of a --profile-generate build once main returns, see CodeGenContext::AddProfileCounters */
+void vl_profile_write(const VLProfileFunction *functions, int64_t count, const char *path)
+{
+    FILE *out = fopen(path, "w");
+
+    if (out == NULL) {
+        fprintf(stderr, "[WARN] Cannot write profile %s\n", path);
+        return;
+    }
+
+    fprintf(out, "%s\n", PROFILE_MAGIC);
+
+    for (int64_t f = 0; f < count; f++) {
+        fprintf(out, "%s %llu %lld", functions[f].name, (unsigned long long)functions[f].hash, (long long)functions[f].num_counters);
+
+        for (int64_t i = 0; i < functions[f].num_counters; i++)
+            fprintf(out, " %llu", (unsigned long long)functions[f].counters[i]);
+        fprintf(out, "\n");
+    }
+
+    fclose(out);
+}
@@ -0,0 +1,33 @@
+#ifndef __RUNTIME_H
+#define __RUNTIME_H
+
+#include <stdint.h>
+
+/*
+ * Runtime support called by generated code. It is linked into executables
+ * as vlrt.o and into the compiler itself, where the JIT binds to it.
+ */
+
+#define READ_INT_FUNC   "vl_read_int"
+#define READ_REAL_FUNC  "vl_read_real"
+#define PROFILE_WRITE_FUNC  "vl_profile_write"
+#define PROFILE_MAGIC       "vlprof 1"
+
+#define READ_BUFFER_SIZE    (1 << 16)
+#define READ_TOKEN_MAX      128
+
+/* One function of an instrumented module: entry count, then taken/not taken per branch */
+struct VLProfileFunction {
+    const char *name;
+    uint64_t hash;
+    uint64_t *counters;
+    int64_t num_counters;
+};
+
+extern "C" {
+    int64_t vl_read_int();
+    double vl_read_real();
+    void vl_profile_write(const VLProfileFunction *functions, int64_t count, const char *path);
+}
+
+#endif
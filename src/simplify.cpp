@@ -0,0 +1,426 @@
+#include <climits>
+#include <unordered_map>
+#include "simplify.hpp"
+#include "trace.hpp"
+#include "arena.hpp"
+#include "codegen.hpp"
+#include "parser.hpp"
+
+/* What the simplifier knows about an expression's value */
+#define VALUE_OTHER     0   /* strings, comparisons, whole arrays */
+#define VALUE_INT       1
+#define VALUE_REAL      2
+#define VALUE_ARRAY     4   /* flag on declarations: the element type */
+
+#define INTEGER_BITS    64
+
+class Simplifier {
+    Arena& arena;
+    std::vector<int> global_types;  /* indexed by Binding::index, like the codegen slots */
+    std::vector<int> local_types;
+    std::unordered_map<Symbol, int> function_types;
+    Symbol integer_id, real_id;
+
+public:
+    unsigned rewrites;
+
+    Simplifier(Arena& arena) :
+        arena(arena), integer_id(Symbol::Intern(INTEGER_ID)), real_id(Symbol::Intern(FLOAT_ID)), rewrites(0) { }
+
+    int typeOf(NIdentifier& type_id) {
+        if (type_id.name == this->integer_id)
+            return VALUE_INT;
+        if (type_id.name == this->real_id)
+            return VALUE_REAL;
+        return VALUE_OTHER;
+    }
+
+    void declare(NVariableDecl& decl) {
+        std::vector<int>& types = (decl.id.binding.scope == BINDING_GLOBAL) ? this->global_types : this->local_types;
+
+        if (types.size() <= decl.id.binding.index)
+            types.resize(decl.id.binding.index + 1, VALUE_OTHER);
+
+        types[decl.id.binding.index] = this->typeOf(decl.type_id) | (decl.type == VARIABLE_ARRAY ? VALUE_ARRAY : 0);
+    }
+
+    void declareFunction(NFunctionDecl& decl) { this->function_types[decl.id.name] = this->typeOf(decl.type); }
+
+    /* -- Expressions: each returns its replacement and sets `type` -- */
+
+    /* Routes an expression to its rewrite; statements never stand in expression position */
+    struct ExprRewrite {
+        Simplifier& simplifier;
+        int& type;
+
+        NExpression *operator()(NInteger& node) { this->type = VALUE_INT; return &node; }
+        NExpression *operator()(NReal& node) { this->type = VALUE_REAL; return &node; }
+        NExpression *operator()(NVariable& node) { return this->simplifier.variable(&node, this->type); }
+        NExpression *operator()(NFunctionCall& node) { return this->simplifier.call(&node, this->type); }
+        NExpression *operator()(NBinaryOp& node) { return this->simplifier.binary(&node, this->type); }
+        NExpression *operator()(NUnaryOp& node) { return this->simplifier.unary(&node, this->type); }
+
+        /* Strings, bare names and placeholders are left alone */
+        NExpression *operator()(NStringLiteral& node) { this->type = VALUE_OTHER; return &node; }
+        NExpression *operator()(NIdentifier& node) { this->type = VALUE_OTHER; return &node; }
+        NExpression *operator()(NExpression& node) { this->type = VALUE_OTHER; return &node; }
+
+        NExpression *operator()(NStatement& node) { this->type = VALUE_OTHER; return NULL; }
+        NExpression *operator()(NProgram& node) { this->type = VALUE_OTHER; return NULL; }
+    };
+
+    NExpression *expr(NExpression *node, int& type) { return VisitNode(*node, ExprRewrite { *this, type }); }
+
+    NExpression *expr(NExpression *node) {
+        int type;
+        return this->expr(node, type);
+    }
+
+    void list(ExpressionList& exprs) {
+        for (ExpressionList::iterator it = exprs.begin(); it != exprs.end(); it++)
+            *it = this->expr(*it);
+    }
+
+    NExpression *variable(NVariable *node, int& type) {
+        const Binding& binding = node->identifier.binding;
+        std::vector<int>& types = (binding.scope == BINDING_GLOBAL) ? this->global_types : this->local_types;
+        int decl_type = (binding.index < types.size()) ? types[binding.index] : VALUE_OTHER;
+
+        if (node->type == VARIABLE_ARRAY) {
+            node->arr_size = this->expr(node->arr_size);
+            type = (decl_type & VALUE_ARRAY) ? (decl_type & ~VALUE_ARRAY) : VALUE_OTHER;
+        } else
+            type = (decl_type & VALUE_ARRAY) ? VALUE_OTHER : decl_type;
+
+        return node;
+    }
+
+    NExpression *call(NFunctionCall *node, int& type) {
+        this->list(node->arguments);
+
+        std::unordered_map<Symbol, int>::const_iterator it = this->function_types.find(node->id.name);
+        type = (it != this->function_types.end()) ? it->second : VALUE_OTHER;
+        return node;
+    }
+
+    NExpression *unary(NUnaryOp *node, int& type) {
+        node->expr = this->expr(node->expr, type);
+        NExpression *operand = node->expr;
+
+        if (node->op == TLOGICNOT && type != VALUE_INT)
+            type = VALUE_OTHER;
+
+        /* - - x, and not not x on an int, where not is bitwise; on a real, not yields a truth value instead */
+        if (operand->kind == NODE_UNARY_OP && static_cast<NUnaryOp*>(operand)->op == node->op
+                && (node->op == TMINUS || type == VALUE_INT)) {
+            this->rewrites++;
+            return static_cast<NUnaryOp*>(operand)->expr;
+        }
+
+        if (node->op == TMINUS && operand->kind == NODE_INTEGER) {
+            this->rewrites++;
+            return this->integer(wrap(0, static_cast<NInteger*>(operand)->value, TMINUS));
+        }
+
+        if (node->op == TMINUS && operand->kind == NODE_REAL) {
+            this->rewrites++;
+            return this->arena.make<NReal>(-static_cast<NReal*>(operand)->value);
+        }
+
+        return node;
+    }
+
+    NExpression *binary(NBinaryOp *node, int& type) {
+        int lhs_type, rhs_type;
+        node->lhs = this->expr(node->lhs, lhs_type);
+        node->rhs = this->expr(node->rhs, rhs_type);
+
+        if (!arithmetic(node->op)) {
+            type = VALUE_OTHER;
+            return node;
+        }
+
+        if (lhs_type == VALUE_REAL || rhs_type == VALUE_REAL)
+            type = VALUE_REAL;
+        else if (lhs_type == VALUE_INT && rhs_type == VALUE_INT)
+            type = VALUE_INT;
+        else
+            type = VALUE_OTHER;
+
+        NExpression *folded = this->fold(node->op, *node->lhs, *node->rhs);
+        if (folded == NULL)
+            folded = this->identity(node, lhs_type, rhs_type, type);
+        if (folded == NULL && type == VALUE_INT)
+            folded = this->strengthReduce(node);
+
+        if (folded == NULL)
+            return node;
+
+        this->rewrites++;
+        return folded;
+    }
+
+    /* Both operands are literals */
+    NExpression *fold(int op, NExpression& lhs, NExpression& rhs) {
+        if (lhs.kind == NODE_INTEGER && rhs.kind == NODE_INTEGER) {
+            ::IntegerType a = static_cast<NInteger&>(lhs).value;
+            ::IntegerType b = static_cast<NInteger&>(rhs).value;
+
+            switch (op) {
+                case TPLUS:
+                case TMINUS:
+                case TMUL:
+                    return this->integer(wrap(a, b, op));
+                case TDIV:
+                case TNUMDIV:
+                case TNUMMOD:
+                    /* These trap at run time, leave them to it */
+                    if (b == 0 || (b == -1 && a == LLONG_MIN))
+                        return NULL;
+                    return this->integer(op == TNUMMOD ? a % b : a / b);
+            }
+            return NULL;
+        }
+
+        ::RealType a, b;
+        if (!number(lhs, a) || !number(rhs, b))
+            return NULL;
+
+        switch (op) {
+            case TPLUS:     return this->arena.make<NReal>(a + b);
+            case TMINUS:    return this->arena.make<NReal>(a - b);
+            case TMUL:      return this->arena.make<NReal>(a * b);
+            case TDIV:      return this->arena.make<NReal>(a / b);
+        }
+        return NULL;
+    }
+
+    /*
+     * One literal operand. Only rewrites that keep the result type and are
+     * exact: x + 0 is not for reals (-0.0 + 0 is +0.0), x * 0 drops x and so
+     * needs x to be an integer without calls in it.
+     */
+    NExpression *identity(NBinaryOp *node, int lhs_type, int rhs_type, int type) {
+        ::RealType l, r;
+        bool lhs_lit = number(*node->lhs, l), rhs_lit = number(*node->rhs, r);
+
+        switch (node->op) {
+            case TPLUS:
+                if (rhs_lit && r == 0 && lhs_type == VALUE_INT && type == VALUE_INT)
+                    return node->lhs;
+                if (lhs_lit && l == 0 && rhs_type == VALUE_INT && type == VALUE_INT)
+                    return node->rhs;
+                break;
+            case TMINUS:
+                if (rhs_lit && r == 0 && lhs_type == type && type != VALUE_OTHER)
+                    return node->lhs;
+                break;
+            case TMUL:
+                if (rhs_lit && r == 1 && lhs_type == type && type != VALUE_OTHER)
+                    return node->lhs;
+                if (lhs_lit && l == 1 && rhs_type == type && type != VALUE_OTHER)
+                    return node->rhs;
+                if (type == VALUE_INT && ((rhs_lit && r == 0 && pure(node->lhs)) || (lhs_lit && l == 0 && pure(node->rhs))))
+                    return this->integer(0);
+                break;
+            case TDIV:
+                if (rhs_lit && r == 1 && lhs_type == type && type != VALUE_OTHER)
+                    return node->lhs;
+                break;
+            case TNUMDIV:
+                if (rhs_lit && r == 1 && type == VALUE_INT)
+                    return node->lhs;
+                break;
+            case TNUMMOD:
+                if (rhs_lit && r == 1 && type == VALUE_INT && pure(node->lhs))
+                    return this->integer(0);
+                break;
+        }
+        return NULL;
+    }
+
+    /*
+     * Integer multiply, divide and modulo by 2^k. Division rounds towards
+     * zero, so a negative x is biased by 2^k - 1 before the arithmetic shift;
+     * x appears more than once then, which is only done for plain variables.
+     */
+    NExpression *strengthReduce(NBinaryOp *node) {
+        int k;
+
+        if (node->op == TMUL) {
+            if ((k = log2(*node->rhs)) > 0)
+                return this->arena.make<NBinaryOp>(*node->lhs, OP_SHL, *this->integer(k));
+            if ((k = log2(*node->lhs)) > 0)
+                return this->arena.make<NBinaryOp>(*node->rhs, OP_SHL, *this->integer(k));
+            return NULL;
+        }
+
+        if (node->op != TDIV && node->op != TNUMDIV && node->op != TNUMMOD)
+            return NULL;
+        if ((k = log2(*node->rhs)) <= 0 || node->lhs->kind != NODE_VARIABLE)
+            return NULL;
+
+        NVariable *x = static_cast<NVariable*>(node->lhs);
+        if (x->type != VARIABLE_BASIC)
+            return NULL;
+
+        NExpression *biased = this->arena.make<NBinaryOp>(*x, TPLUS, *this->bias(x, k));
+
+        if (node->op != TNUMMOD)
+            return this->arena.make<NBinaryOp>(*biased, OP_ASHR, *this->integer(k));
+
+        NExpression *low_bits = this->arena.make<NBinaryOp>(*biased, OP_BITAND, *this->integer((1LL << k) - 1));
+        return this->arena.make<NBinaryOp>(*low_bits, TMINUS, *this->bias(x, k));
+    }
+
+    /* 2^k - 1 when x is negative, 0 otherwise */
+    NExpression *bias(NVariable *x, int k) {
+        NVariable *copy = this->arena.make<NVariable>(x->identifier, x->type, *x->arr_size);
+        NExpression *sign = this->arena.make<NBinaryOp>(*copy, OP_ASHR, *this->integer(INTEGER_BITS - 1));
+        return this->arena.make<NBinaryOp>(*sign, OP_LSHR, *this->integer(INTEGER_BITS - k));
+    }
+
+    NInteger *integer(::IntegerType value) { return this->arena.make<NInteger>(value); }
+
+    static bool arithmetic(int op) {
+        return op == TPLUS || op == TMINUS || op == TMUL || op == TDIV || op == TNUMDIV || op == TNUMMOD;
+    }
+
+    static bool number(NExpression& node, ::RealType& value) {
+        if (node.kind == NODE_INTEGER)
+            value = static_cast<NInteger&>(node).value;
+        else if (node.kind == NODE_REAL)
+            value = static_cast<NReal&>(node).value;
+        else
+            return false;
+        return true;
+    }
+
+    /* Two's complement, like the generated add/sub/mul */
+    static ::IntegerType wrap(::IntegerType a, ::IntegerType b, int op) {
+        unsigned long long ua = a, ub = b;
+
+        switch (op) {
+            case TPLUS:     return (::IntegerType)(ua + ub);
+            case TMINUS:    return (::IntegerType)(ua - ub);
+            default:        return (::IntegerType)(ua * ub);
+        }
+    }
+
+    /* k for an integer literal 2^k, -1 otherwise */
+    static int log2(NExpression& node) {
+        if (node.kind != NODE_INTEGER)
+            return -1;
+
+        ::IntegerType value = static_cast<NInteger&>(node).value;
+        if (value <= 0 || (value & (value - 1)) != 0)
+            return -1;
+
+        int k = 0;
+        while ((1LL << k) != value)
+            k++;
+        return k;
+    }
+
+    /* Nothing but reads: safe to drop */
+    struct PureCheck {
+        bool operator()(NFunctionCall& node) { return false; }
+        bool operator()(NVariable& node) { return pure(node.arr_size); }
+        bool operator()(NBinaryOp& node) { return pure(node.lhs) && pure(node.rhs); }
+        bool operator()(NUnaryOp& node) { return pure(node.expr); }
+        bool operator()(NInteger& node) { return true; }
+        bool operator()(NReal& node) { return true; }
+        bool operator()(NStringLiteral& node) { return true; }
+        bool operator()(NIdentifier& node) { return true; }
+        bool operator()(NExpression& node) { return true; }
+        bool operator()(NStatement& node) { return true; }
+        bool operator()(NProgram& node) { return true; }
+    };
+
+    static bool pure(NExpression *node) { return VisitNode(*node, PureCheck()); }
+
+    /* -- Statements -- */
+
+    void walk(Node& node) { VisitNode(node, *this); }
+
+    void walk(StatementList& list) {
+        for (StatementList::iterator it = list.begin(); it != list.end(); it++)
+            this->walk(**it);
+    }
+
+    void operator()(NAssignment& node) {
+        int type;
+        this->variable(&node.lhs, type);
+        node.rhs = this->expr(node.rhs);
+    }
+
+    void operator()(NExpressionStatement& node) { node.expression = this->expr(node.expression); }
+    void operator()(NVariableDecl& node) { this->declare(node); }
+
+    void operator()(NVariableCompoundDecl& node) {
+        for (VariableList::iterator it = node.decls.begin(); it != node.decls.end(); it++)
+            this->declare(**it);
+    }
+
+    /* Local bindings restart at zero in every function, nested ones included */
+    void operator()(NFunctionDecl& node) {
+        std::vector<int> outer_types;
+        outer_types.swap(this->local_types);
+
+        this->declareFunction(node);
+        for (VariableList::iterator it = node.arguments.begin(); it != node.arguments.end(); it++)
+            this->declare(**it);
+        this->walk(node.body);
+
+        this->local_types.swap(outer_types);
+    }
+
+    void operator()(NIfStatement& node) {
+        node.condition = this->expr(node.condition);
+        this->walk(node.then_body);
+        this->walk(node.else_body);
+    }
+
+    void operator()(NForStatement& node) {
+        int type;
+        this->variable(&node.iterator, type);
+        node.iter_assign = this->expr(node.iter_assign);
+        node.iter_until = this->expr(node.iter_until);
+        node.iter_by = this->expr(node.iter_by);
+        this->walk(node.body);
+    }
+
+    void operator()(NWhileStatement& node) {
+        node.condition = this->expr(node.condition);
+        this->walk(node.body);
+    }
+
+    void operator()(NPrintStatement& node) { this->list(node.arguments); }
+    void operator()(NReadStatement& node) { this->list(node.destinations); }
+    void operator()(NReturnStatement& node) { node.expression = this->expr(node.expression); }
+
+    /* Calls can come before the callee's declaration */
+    void operator()(NProgram& node) {
+        StatementList::iterator it;
+        for (it = node.function_decl_stmts.begin(); it != node.function_decl_stmts.end(); it++) {
+            if ((**it).kind == NODE_FUNCTION_DECL)
+                this->declareFunction(static_cast<NFunctionDecl&>(**it));
+        }
+
+        this->walk(node.variable_decl_stmts);
+        this->walk(node.function_decl_stmts);
+    }
+
+    void operator()(NStatement& node) { }
+    void operator()(NExpression& node) { }
+};
+
+unsigned SimplifyProgram(NProgram& root)
+{
+    TraceScope trace("simplify");
+    Simplifier simplifier(*root.arena);
+
+    simplifier.walk(root);
+
+    return simplifier.rewrites;
+}
@@ -0,0 +1,15 @@
+#ifndef __SIMPLIFY_H
+#define __SIMPLIFY_H
+
+#include "node.hpp"
+
+/*
+ * Rewrites expressions in place before code generation: folds integer and
+ * real constants, drops identities (x + 0, x * 1, x * 0 for integers, - - x)
+ * and turns integer multiply, divide and modulo by a power of two into
+ * shifts and masks. Needs the bindings of ResolveNames() for variable types;
+ * new nodes go into the program's arena. Returns the number of rewrites.
+ */
+unsigned SimplifyProgram(NProgram& root);
+
+#endif
@@ -0,0 +1,86 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "source.hpp"
+
+bool SourceFile::Open(const char *path)
+{
+    this->Close();
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return false;
+    }
+
+    this->length = info.st_size;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t tail = this->length % page;
+
+    /* Past the end of the file the last page reads as zeros, and a private mapping may write there */
+    if (this->length != 0 && tail != 0 && page - tail >= SCAN_PADDING) {
+        void *mem = mmap(NULL, this->ScanSize(), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+        if (mem != MAP_FAILED) {
+            madvise(mem, this->ScanSize(), MADV_SEQUENTIAL);
+            this->data = static_cast<char *>(mem);
+            this->mapped = true;
+            close(fd);
+            return true;
+        }
+    }
+
+    this->data = static_cast<char *>(malloc(this->ScanSize()));
+    size_t done = 0;
+
+    while (this->data != NULL && done < this->length) {
+        ssize_t count = read(fd, this->data + done, this->length - done);
+
+        if (count <= 0) {
+            int error = count == 0 ? EIO : errno;
+            if (count < 0 && error == EINTR)
+                continue;
+
+            close(fd);
+            this->Close();
+            errno = error;
+            return false;
+        }
+        done += count;
+    }
+
+    close(fd);
+
+    if (this->data == NULL) {
+        this->length = 0;
+        errno = ENOMEM;
+        return false;
+    }
+
+    memset(this->data + this->length, 0, SCAN_PADDING);
+    return true;
+}
+
+void SourceFile::Close()
+{
+    if (this->data != NULL) {
+        if (this->mapped)
+            munmap(this->data, this->ScanSize());
+        else
+            free(this->data);
+    }
+
+    this->data = NULL;
+    this->length = 0;
+    this->mapped = false;
+}
@@ -0,0 +1,38 @@
+#ifndef __SOURCE_H
+#define __SOURCE_H
+
+#include <stddef.h>
+
+/* flex scans a buffer in place when it ends in two of these */
+#define SCAN_PADDING    2
+
+/*
+ * A source file laid out for the scanner: the text followed by SCAN_PADDING
+ * NULs. The file is mapped privately when the padding fits in the zero fill
+ * of its last page, so nothing is read or copied up front; the kernel only
+ * copies the pages the scanner writes its temporary NULs into. Files that
+ * fill their last page (and empty ones) are read into a padded buffer.
+ */
+class SourceFile {
+    char *data;
+    size_t length;
+    bool mapped;
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+public:
+    SourceFile() : data(NULL), length(0), mapped(false) { }
+    ~SourceFile() { this->Close(); }
+
+    /* false with errno set when the file cannot be opened or read */
+    bool Open(const char *path);
+    void Close();
+
+    char *ScanBuffer() { return this->data; }
+    size_t ScanSize() const { return this->length + SCAN_PADDING; }
+    size_t Length() const { return this->length; }
+    bool IsMapped() const { return this->mapped; }
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include <string.h>
+#include <sstream>
+#include "stats.hpp"
+#include "arena.hpp"
+
+static const char *node_names[] = {
+    "NExpression", "NInteger", "NReal", "NStringLiteral", "NIdentifier", "NVariable",
+    "NFunctionCall", "NBinaryOp", "NUnaryOp", "NStatement", "NAssignment",
+    "NExpressionStatement", "NVariableDecl", "NVariableCompoundDecl", "NFunctionDecl",
+    "NIfStatement", "NForStatement", "NWhileStatement", "NPrintStatement",
+    "NReadStatement", "NReturnStatement", "NProgram"
+};
+
+/* Counts every node of the tree by kind, identifiers and the parser's placeholders included */
+class NodeCounter {
+public:
+    size_t kinds[NODE_PROGRAM + 1];
+
+    NodeCounter() { memset(this->kinds, 0, sizeof(this->kinds)); }
+
+    void walk(Node& node) {
+        this->kinds[node.kind]++;
+        VisitNode(node, *this);
+    }
+
+    void walk(StatementList& list) {
+        for (StatementList::iterator it = list.begin(); it != list.end(); it++)
+            this->walk(**it);
+    }
+
+    void walk(ExpressionList& list) {
+        for (ExpressionList::iterator it = list.begin(); it != list.end(); it++)
+            this->walk(**it);
+    }
+
+    void walk(VariableList& list) {
+        for (VariableList::iterator it = list.begin(); it != list.end(); it++)
+            this->walk(**it);
+    }
+
+    void operator()(NVariable& node) { this->walk(node.identifier); this->walk(*node.arr_size); }
+    void operator()(NFunctionCall& node) { this->walk(node.id); this->walk(node.arguments); }
+    void operator()(NBinaryOp& node) { this->walk(*node.lhs); this->walk(*node.rhs); }
+    void operator()(NUnaryOp& node) { this->walk(*node.expr); }
+    void operator()(NAssignment& node) { this->walk(node.lhs); this->walk(*node.rhs); }
+    void operator()(NExpressionStatement& node) { this->walk(*node.expression); }
+    void operator()(NVariableDecl& node) { this->walk(node.id); this->walk(node.type_id); }
+    void operator()(NVariableCompoundDecl& node) { this->walk(node.decls); }
+
+    void operator()(NFunctionDecl& node) {
+        this->walk(node.type);
+        this->walk(node.id);
+        this->walk(node.arguments);
+        this->walk(node.body);
+    }
+
+    void operator()(NIfStatement& node) {
+        this->walk(*node.condition);
+        this->walk(node.then_body);
+        this->walk(node.else_body);
+    }
+
+    void operator()(NForStatement& node) {
+        this->walk(node.iterator);
+        this->walk(*node.iter_assign);
+        this->walk(*node.iter_until);
+        this->walk(*node.iter_by);
+        this->walk(node.body);
+    }
+
+    void operator()(NWhileStatement& node) { this->walk(*node.condition); this->walk(node.body); }
+    void operator()(NPrintStatement& node) { this->walk(node.arguments); }
+    void operator()(NReadStatement& node) { this->walk(node.destinations); }
+    void operator()(NReturnStatement& node) { this->walk(*node.expression); }
+    void operator()(NProgram& node) { this->walk(node.variable_decl_stmts); this->walk(node.function_decl_stmts); }
+
+    /* Literals, identifiers and placeholders have no children */
+    void operator()(Node& node) { }
+};
+
+std::string ProgramStats(const std::string& name, NProgram& program, CodeGenContext& context)
+{
+    std::ostringstream out;
+    /* The tree as code generation saw it, after simplification */
+    NodeCounter counter;
+    counter.walk(program);
+
+    size_t nodes = 0;
+    for (size_t k = 0; k <= NODE_PROGRAM; k++)
+        nodes += counter.kinds[k];
+
+    out << "[STATS] " << name << ": " << nodes << " AST nodes, " << program.arena->BytesAllocated()
+        << " bytes in the arena" << std::endl;
+    for (size_t k = 0; k <= NODE_PROGRAM; k++)
+        if (counter.kinds[k] != 0)
+            out << "[STATS]   " << node_names[k] << ": " << counter.kinds[k] << std::endl;
+
+    out << "[STATS] " << name << ": " << Symbol::Count() << " interned symbols, " << context.global_slots.size()
+        << " global slots, " << context.functions.size() << " functions and " << context.function_decls.size()
+        << " top-level declarations in the code generator, " << context.simplify_rewrites << " simplifier rewrites";
+    if (context.cache_hits + context.cache_misses != 0)
+        out << ", " << context.cache_hits << " cache hits, " << context.cache_misses << " misses";
+    out << std::endl;
+
+    size_t defined = 0, declared = 0, blocks = 0, instructions = 0;
+    for (Function& func : *context.module) {
+        if (func.isDeclaration()) {
+            declared++;
+            continue;
+        }
+
+        defined++;
+        blocks += func.size();
+        for (BasicBlock& block : func)
+            instructions += block.size();
+    }
+
+    out << "[STATS] " << name << ": module has " << defined << " functions (" << declared << " declared), "
+        << blocks << " basic blocks, " << instructions << " instructions, " << context.module->global_size()
+        << " globals, " << context.GetBitcodeBuffer()->getBufferSize() << " bytes of bitcode" << std::endl;
+
+    return out.str();
+}
@@ -0,0 +1,17 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <string>
+
+#include "codegen.hpp"
+#include "node.hpp"
+
+/*
+ * What one compilation is made of, for --stats: AST nodes by kind and the
+ * bytes they take, the code generator's tables and the functions, blocks,
+ * instructions and globals of the final module, as [STATS] lines. Has to
+ * run before the module is emitted or handed over to the JIT.
+ */
+std::string ProgramStats(const std::string& name, NProgram& program, CodeGenContext& context);
+
+#endif
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <llvm/ADT/StringMap.h>
+#include "symbol.hpp"
+
+/* Names are looked up through fixed chunks of slots, so a lookup never sees a container resize */
+#define CHUNK_BITS  12
+#define CHUNK_SIZE  (1u << CHUNK_BITS)
+#define MAX_CHUNKS  (1u << 16)
+
+typedef std::atomic<const std::string*> NameSlot;
+
+class SymbolTable {
+public:
+    llvm::StringMap<uint32_t> index;
+    std::deque<std::string> names;  /* deque: references stay valid as it grows */
+    std::mutex lock;                /* parsers on several threads intern into the same table */
+
+    /* Written under the lock, read without it: a slot is published only once its name is in place */
+    std::atomic<NameSlot*> chunks[MAX_CHUNKS];
+    std::atomic<uint32_t> count;
+
+    SymbolTable() : count(0) {
+        for (uint32_t i = 0; i < MAX_CHUNKS; i++)
+            this->chunks[i].store(NULL, std::memory_order_relaxed);
+    }
+
+    static SymbolTable& Get() {
+        static SymbolTable table;
+        return table;
+    }
+
+    /* Caller holds the lock */
+    void publish(uint32_t id, const std::string *name) {
+        NameSlot *chunk = this->chunks[id >> CHUNK_BITS].load(std::memory_order_relaxed);
+
+        if (chunk == NULL) {
+            chunk = new NameSlot[CHUNK_SIZE];
+            this->chunks[id >> CHUNK_BITS].store(chunk, std::memory_order_release);
+        }
+
+        chunk[id & (CHUNK_SIZE - 1)].store(name, std::memory_order_release);
+        this->count.store(id + 1, std::memory_order_release);
+    }
+};
+
+Symbol Symbol::Intern(const char *text, size_t length)
+{
+    SymbolTable& table = SymbolTable::Get();
+    std::lock_guard<std::mutex> guard(table.lock);
+
+    std::pair<llvm::StringMap<uint32_t>::iterator, bool> entry =
+        table.index.insert(std::make_pair(llvm::StringRef(text, length), uint32_t(table.names.size())));
+
+    if (entry.second) {
+        if (table.names.size() >= size_t(MAX_CHUNKS) * CHUNK_SIZE) {
+            std::cerr << "[ERROR] Symbol table is full" << std::endl;
+            abort();
+        }
+
+        table.names.push_back(std::string(text, length));
+        table.publish(entry.first->second, &table.names.back());
+    }
+
+    return Symbol::FromId(entry.first->second);
+}
+
+size_t Symbol::Count()
+{
+    return SymbolTable::Get().count.load(std::memory_order_acquire);
+}
+
+const std::string& Symbol::str() const
+{
+    NameSlot *chunk = SymbolTable::Get().chunks[this->id >> CHUNK_BITS].load(std::memory_order_acquire);
+
+    return *chunk[this->id & (CHUNK_SIZE - 1)].load(std::memory_order_acquire);
+}
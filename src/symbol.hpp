@@ -0,0 +1,42 @@
+#ifndef __SYMBOL_H
+#define __SYMBOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <iostream>
+#include <string>
+#include <functional>
+
+/*
+ * Handle to an interned identifier. Every distinct spelling is stored once in
+ * a process-wide table, so comparing and hashing symbols is a single integer
+ * operation. Kept trivial so it can travel through the Bison value union.
+ * The table is shared by all threads: interning takes a lock, looking a
+ * name up with str() does not.
+ */
+struct Symbol {
+    uint32_t id;
+
+    static Symbol Intern(const char *text, size_t length);
+    static Symbol Intern(const std::string& text) { return Intern(text.data(), text.size()); }
+    static Symbol FromId(uint32_t id) { Symbol sym; sym.id = id; return sym; }
+    static size_t Count();
+
+    const std::string& str() const;
+    const char *c_str() const { return this->str().c_str(); }
+
+    bool operator==(Symbol other) const { return this->id == other.id; }
+    bool operator!=(Symbol other) const { return this->id != other.id; }
+    bool operator<(Symbol other) const { return this->id < other.id; }
+};
+
+inline std::ostream& operator<<(std::ostream& os, Symbol sym) { return os << sym.str(); }
+
+namespace std {
+    template <>
+    struct hash<Symbol> {
+        size_t operator()(Symbol sym) const { return sym.id; }
+    };
+}
+
+#endif
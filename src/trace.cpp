@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+#include "trace.hpp"
+
+#define SUMMARY_FUNCTIONS   10
+
+struct TraceEvent {
+    std::string name;
+    const char *category;
+    std::string detail;
+    int64_t start;
+    int64_t duration;
+    unsigned thread;
+    int64_t rss;            /* KB at the end, -1 when not measured */
+    int64_t rss_growth;
+    int64_t peak_rss;
+};
+
+bool Trace::enabled = false;
+bool Trace::memory = false;
+
+static std::mutex events_lock;
+static std::vector<TraceEvent> events;
+static std::atomic<unsigned> next_thread(0);
+static std::atomic<int64_t> run_peak_rss(-1);
+
+/* Innermost phase on this thread whose memory is measured */
+static thread_local TraceScope *memory_scope = NULL;
+
+/* Small stable thread numbers read better in a trace viewer than native ids */
+static unsigned thread_number()
+{
+    static thread_local unsigned number = next_thread++;
+    return number;
+}
+
+void Trace::Enable()
+{
+    Trace::Now();
+    enabled = true;
+}
+
+int64_t Trace::Now()
+{
+    static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+/* Current resident set from /proc, Linux only; -1 elsewhere */
+int64_t Trace::ResidentKB()
+{
+    FILE *statm = fopen("/proc/self/statm", "r");
+    long long pages_total, pages_resident;
+
+    if (statm == NULL)
+        return -1;
+
+    int fields = fscanf(statm, "%lld %lld", &pages_total, &pages_resident);
+    fclose(statm);
+
+    return fields == 2 ? pages_resident * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+}
+
+/* High-water mark of the resident set since the last ResetPeakResident(), VmHWM on Linux */
+int64_t Trace::PeakResidentKB()
+{
+    FILE *status = fopen("/proc/self/status", "r");
+    char line[128];
+    long long peak = -1;
+
+    if (status != NULL) {
+        while (fgets(line, sizeof(line), status) != NULL)
+            if (sscanf(line, "VmHWM: %lld", &peak) == 1)
+                break;
+        fclose(status);
+    } else {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+            peak = usage.ru_maxrss;
+    }
+
+    /* The reset also clears ru_maxrss, so the run's peak is kept here */
+    int64_t run_peak = run_peak_rss.load();
+    while (peak > run_peak && !run_peak_rss.compare_exchange_weak(run_peak, peak))
+        ;
+
+    return peak;
+}
+
+/*
+ * Lowers the high-water mark to the current resident set (Linux 4.0 and
+ * later). It is process-wide: phases running on other threads at the
+ * same time lose what they reached so far. Without it, peaks are since
+ * the start of the process.
+ */
+void Trace::ResetPeakResident()
+{
+    FILE *clear_refs = fopen("/proc/self/clear_refs", "w");
+
+    if (clear_refs == NULL)
+        return;
+    fputs("5", clear_refs);
+    fclose(clear_refs);
+}
+
+/* High-water mark of the whole run, across resets */
+int64_t Trace::RunPeakResidentKB()
+{
+    PeakResidentKB();
+    return run_peak_rss.load();
+}
+
+TraceScope::TraceScope(const char *name, const char *category, const char *detail) :
+    name(name), category(category), detail(detail), start(Trace::Enabled() ? Trace::Now() : 0),
+    rss_start(-1), peak_rss(-1), outer(NULL)
+{
+    if (!Trace::MemoryEnabled() || strcmp(category, TRACE_PHASE) != 0)
+        return;
+
+    /* What the enclosing phase reached so far is kept before the mark is reset for this one */
+    this->outer = memory_scope;
+    if (this->outer != NULL)
+        this->outer->peak_rss = std::max(this->outer->peak_rss, Trace::PeakResidentKB());
+    Trace::ResetPeakResident();
+
+    memory_scope = this;
+    this->rss_start = Trace::ResidentKB();
+}
+
+TraceScope::~TraceScope()
+{
+    if (this->rss_start >= 0) {
+        this->peak_rss = std::max(this->peak_rss, Trace::PeakResidentKB());
+
+        /* The enclosing phase's peak includes this one's */
+        memory_scope = this->outer;
+        if (this->outer != NULL)
+            this->outer->peak_rss = std::max(this->outer->peak_rss, this->peak_rss);
+    }
+
+    if (Trace::Enabled())
+        Trace::Add(this->name, this->category, this->start, Trace::Now() - this->start, this->detail, this->rss_start, this->peak_rss);
+}
+
+void Trace::Add(const char *name, const char *category, int64_t start, int64_t duration, const char *detail,
+    int64_t rss_start, int64_t peak_rss)
+{
+    TraceEvent event = { name, category, detail == NULL ? "" : detail, start, duration, thread_number(), -1, 0, peak_rss };
+
+    if (rss_start >= 0) {
+        event.rss = ResidentKB();
+        event.rss_growth = event.rss - rss_start;
+    }
+
+    std::lock_guard<std::mutex> guard(events_lock);
+    events.push_back(event);
+}
+
+static void write_json_string(FILE *out, const std::string& text)
+{
+    fputc('"', out);
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+bool Trace::WriteChromeTrace(const std::string& filename)
+{
+    FILE *out = fopen(filename.c_str(), "w");
+    if (out == NULL)
+        return false;
+
+    std::lock_guard<std::mutex> guard(events_lock);
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (size_t i = 0; i < events.size(); i++) {
+        const TraceEvent& event = events[i];
+
+        fprintf(out, "%s\n{\"name\":", i == 0 ? "" : ",");
+        write_json_string(out, event.name);
+        fprintf(out, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u",
+            event.category, event.start / 1000.0, event.duration / 1000.0, event.thread);
+
+        if (!event.detail.empty() || event.rss >= 0) {
+            fprintf(out, ",\"args\":{");
+            if (!event.detail.empty()) {
+                fprintf(out, "\"detail\":");
+                write_json_string(out, event.detail);
+            }
+            if (event.rss >= 0)
+                fprintf(out, "%s\"rss_kb\":%lld,\"rss_growth_kb\":%lld,\"peak_rss_kb\":%lld", event.detail.empty() ? "" : ",",
+                    (long long)event.rss, (long long)event.rss_growth, (long long)event.peak_rss);
+            fprintf(out, "}");
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n]}\n");
+
+    return fclose(out) == 0;
+}
+
+void Trace::PrintSummary(std::ostream& out)
+{
+    struct Total {
+        std::string name;
+        unsigned count;
+        int64_t duration;
+    };
+
+    std::vector<Total> phases;
+    std::vector<const TraceEvent*> functions;
+
+    std::lock_guard<std::mutex> guard(events_lock);
+
+    /* Phases in order of first appearance, so the table reads like the pipeline */
+    std::vector<const TraceEvent*> ordered;
+    for (const TraceEvent& event : events)
+        ordered.push_back(&event);
+    std::stable_sort(ordered.begin(), ordered.end(),
+        [](const TraceEvent *a, const TraceEvent *b) { return a->start < b->start; });
+
+    for (const TraceEvent *event : ordered) {
+        if (event->category == std::string(TRACE_FUNCTION)) {
+            functions.push_back(event);
+            continue;
+        }
+
+        std::vector<Total>::iterator total = std::find_if(phases.begin(), phases.end(),
+            [event](const Total& t) { return t.name == event->name; });
+        if (total == phases.end())
+            phases.push_back(Total { event->name, 1, event->duration });
+        else
+            total->count++, total->duration += event->duration;
+    }
+
+    out << std::fixed << std::setprecision(3);
+    out << "[TRACE] " << std::left << std::setw(16) << "phase" << std::right << std::setw(8) << "count" << std::setw(14) << "ms" << std::endl;
+    for (const Total& total : phases)
+        out << "[TRACE] " << std::left << std::setw(16) << total.name << std::right << std::setw(8) << total.count
+            << std::setw(14) << total.duration / 1e6 << std::endl;
+
+    std::stable_sort(functions.begin(), functions.end(),
+        [](const TraceEvent *a, const TraceEvent *b) { return a->duration > b->duration; });
+
+    if (!functions.empty())
+        out << "[TRACE] slowest of " << functions.size() << " function(s) to generate:" << std::endl;
+    for (size_t i = 0; i < functions.size() && i < SUMMARY_FUNCTIONS; i++)
+        out << "[TRACE]   " << std::left << std::setw(22) << functions[i]->name << std::right
+            << std::setw(14) << functions[i]->duration / 1e6 << std::endl;
+    out << std::defaultfloat;
+}
+
+void Trace::PrintMemory(std::ostream& out)
+{
+    struct Total {
+        std::string name;
+        unsigned count;
+        int64_t rss;
+        int64_t growth;
+        int64_t peak_rss;
+    };
+
+    std::vector<Total> phases;
+
+    std::lock_guard<std::mutex> guard(events_lock);
+
+    std::vector<const TraceEvent*> ordered;
+    for (const TraceEvent& event : events)
+        if (event.rss >= 0)
+            ordered.push_back(&event);
+    std::stable_sort(ordered.begin(), ordered.end(),
+        [](const TraceEvent *a, const TraceEvent *b) { return a->start < b->start; });
+
+    /* Phases overlap when files or shards run on several threads, so only the largest values mean much */
+    for (const TraceEvent *event : ordered) {
+        std::vector<Total>::iterator total = std::find_if(phases.begin(), phases.end(),
+            [event](const Total& t) { return t.name == event->name; });
+        if (total == phases.end()) {
+            phases.push_back(Total { event->name, 1, event->rss, event->rss_growth, event->peak_rss });
+        } else {
+            total->count++;
+            total->rss = std::max(total->rss, event->rss);
+            total->growth = std::max(total->growth, event->rss_growth);
+            total->peak_rss = std::max(total->peak_rss, event->peak_rss);
+        }
+    }
+
+    out << std::fixed << std::setprecision(1);
+    out << "[STATS] " << std::left << std::setw(16) << "phase" << std::right << std::setw(8) << "count"
+        << std::setw(14) << "rss MB" << std::setw(14) << "growth MB" << std::setw(14) << "peak MB" << std::endl;
+    for (const Total& total : phases)
+        out << "[STATS] " << std::left << std::setw(16) << total.name << std::right << std::setw(8) << total.count
+            << std::setw(14) << total.rss / 1024.0 << std::setw(14) << total.growth / 1024.0
+            << std::setw(14) << total.peak_rss / 1024.0 << std::endl;
+    out << "[STATS] high-water mark of the whole run: " << RunPeakResidentKB() / 1024.0 << " MB" << std::endl;
+    out << std::defaultfloat;
+}
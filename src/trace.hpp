@@ -0,0 +1,63 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+
+#define TRACE_FILE      "vlc-trace.json"
+#define TRACE_PHASE     "phase"
+#define TRACE_FUNCTION  "function"
+
+/*
+ * Process-wide recorder of compile phases. Off by default; once enabled,
+ * every TraceScope adds one complete event (name, category, start, length,
+ * thread) under a lock. Times are nanoseconds since the first call to Now().
+ * With memory accounting on, phase events also carry the resident set size
+ * at their end, how much it grew during the phase and its peak within the
+ * phase: every phase resets the kernel's high-water mark when it starts.
+ */
+class Trace {
+public:
+    static void Enable();
+    static bool Enabled() { return enabled; }
+    static void EnableMemory() { Enable(); memory = true; }
+    static bool MemoryEnabled() { return memory; }
+    static int64_t Now();
+    static int64_t ResidentKB();
+    static int64_t PeakResidentKB();
+    static void ResetPeakResident();
+    static int64_t RunPeakResidentKB();
+
+    static void Add(const char *name, const char *category, int64_t start, int64_t duration, const char *detail,
+        int64_t rss_start = -1, int64_t peak_rss = -1);
+
+    /* Chrome trace_event format, for chrome://tracing or ui.perfetto.dev */
+    static bool WriteChromeTrace(const std::string& filename);
+    /* Time per phase over all files and threads, then the slowest functions */
+    static void PrintSummary(std::ostream& out);
+    /* RSS per phase, see EnableMemory */
+    static void PrintMemory(std::ostream& out);
+
+private:
+    static bool enabled;
+    static bool memory;
+};
+
+/* Records its own lifetime; name and detail have to outlive the scope, and scopes nest */
+class TraceScope {
+    const char *name;
+    const char *category;
+    const char *detail;
+    int64_t start;
+    int64_t rss_start;
+    int64_t peak_rss;       /* KB, highest high-water mark seen during the phase */
+    TraceScope *outer;      /* enclosing phase on this thread whose memory is measured */
+
+public:
+    TraceScope(const char *name, const char *category = TRACE_PHASE, const char *detail = NULL);
+    ~TraceScope();
+};
+
+#endif
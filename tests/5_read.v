@@ -0,0 +1,24 @@
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% File: 5_read.v                                   %
+% Malformed numbers in the input read as 0 (or     %
+% their integer prefix) and do not stall the reads %
+% that come after them. Input in 5_read.in.        %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+var v: int[7];
+
+int func main()
+    var i: int, r: real, last: int;
+
+    for i := 0 to 6
+        read v[i];
+    endfor;
+    read r, last;
+
+    for i := 0 to 6
+        print v[i], "\n";
+    endfor;
+    print r, " ", last, "\n";
+
+    return 0;
+endfunc
@@ -0,0 +1,36 @@
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% File: 6_nested.v                                 %
+% Nested functions named alike in two functions,   %
+% one of them like a top-level function. Calls go  %
+% to the function in scope, and the shards and     %
+% cache units linking them must not clash.         %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+int func twice(x: int)
+    return x + x;
+endfunc
+
+int func f(n: int)
+    int func step(x: int)
+        return x + 1;
+    endfunc;
+
+    int func twice(x: int)
+        return x * 100;
+    endfunc;
+
+    return step(twice(n));
+endfunc
+
+int func g(n: int)
+    int func step(x: int)
+        return x - 1;
+    endfunc;
+
+    return step(twice(n));
+endfunc
+
+int func main()
+    print f(2), " ", g(2), "\n";
+    return 0;
+endfunc
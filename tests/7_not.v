@@ -0,0 +1,35 @@
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% File: 7_not.v                                    %
+% Double negations. not not on a real is a truth   %
+% value, not the real, so it still makes a valid   %
+% condition. Output in 7_not.out.                  %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+int func main()
+    var r: real, z: real, i: int;
+
+    r := 2.5;
+    z := 0.0;
+    i := 3;
+
+    if not not r then
+        print "r\n";
+    endif;
+
+    if not not z then
+        print "z\n";
+    else
+        print "no z\n";
+    endif;
+
+    while not not z do
+        z := 0.0;
+    endwhile;
+
+    if not not i then
+        print "i\n";
+    endif;
+
+    print - - r, " ", - - i, "\n";
+    return 0;
+endfunc